@@ -0,0 +1,163 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+
+// Reader for the single-file frame archives written by the simulation's
+// FrameArchiveWriter. Layout (little-endian): a 16 byte header with magic
+// "SPHA", version, frame alignment and a reserved word, then every frame
+// in the frame file layout (see FrameFile), then the index with a 24 byte
+// entry per frame (frame index, reserved, uint64 offset, uint64 size), then
+// a 24 byte footer with the uint64 index offset, frame count, version,
+// magic "SPHI" and a reserved word.
+//
+// The archive is memory-mapped, so a frame only costs reading its own
+// bytes. Archives without a footer, from a run that did not finish, are
+// read by walking the frame headers instead.
+public class FrameArchive : IDisposable
+{
+    public const uint Version = 1;
+
+    // Archive written by the simulation, relative to the project.
+    public const string DefaultPath = "Assets/Positions/Frames.sfa";
+
+    private const int HeaderSize = 16;
+    private const int EntrySize = 24;
+    private const int FooterSize = 24;
+    private const int FrameHeaderSize = 56;
+
+    private string path;
+    private MemoryMappedFile file;
+    private MemoryMappedViewAccessor view;
+    private long size;
+    private Dictionary<uint, long> frameOffsets = new Dictionary<uint, long>();
+    private Dictionary<uint, long> frameSizes = new Dictionary<uint, long>();
+
+    public int FrameCount
+    {
+        get { return frameOffsets.Count; }
+    }
+
+    public static FrameArchive Open(string path)
+    {
+        FrameArchive archive = new FrameArchive();
+        archive.path = path;
+        archive.size = new FileInfo(path).Length;
+        if (archive.size < HeaderSize)
+        {
+            throw new InvalidDataException(path + " is not a frame archive");
+        }
+        archive.file = MemoryMappedFile.CreateFromFile(path, FileMode.Open, null, 0, MemoryMappedFileAccess.Read);
+        archive.view = archive.file.CreateViewAccessor(0, 0, MemoryMappedFileAccess.Read);
+        try
+        {
+            if (archive.ReadMagic(0) != "SPHA")
+            {
+                throw new InvalidDataException(path + " is not a frame archive");
+            }
+            if (!archive.ReadIndex())
+            {
+                archive.RebuildIndex(archive.view.ReadUInt32(8));
+            }
+        }
+        catch
+        {
+            archive.Dispose();
+            throw;
+        }
+        return archive;
+    }
+
+    public bool Contains(int frameIndex)
+    {
+        return frameOffsets.ContainsKey((uint)frameIndex);
+    }
+
+    public FrameFile Load(int frameIndex)
+    {
+        long offset = frameOffsets[(uint)frameIndex];
+        using (Stream stream = file.CreateViewStream(offset, frameSizes[(uint)frameIndex], MemoryMappedFileAccess.Read))
+        {
+            return FrameFile.Read(stream, path + " frame " + frameIndex.ToString());
+        }
+    }
+
+    public void Dispose()
+    {
+        if (view != null)
+        {
+            view.Dispose();
+            view = null;
+        }
+        if (file != null)
+        {
+            file.Dispose();
+            file = null;
+        }
+    }
+
+    private string ReadMagic(long offset)
+    {
+        byte[] magic = new byte[4];
+        view.ReadArray(offset, magic, 0, 4);
+        return System.Text.Encoding.ASCII.GetString(magic);
+    }
+
+    private bool ReadIndex()
+    {
+        if (size < HeaderSize + FooterSize)
+        {
+            return false;
+        }
+        long footerOffset = size - FooterSize;
+        long indexOffset = view.ReadInt64(footerOffset);
+        long frameCount = view.ReadUInt32(footerOffset + 8);
+        if (ReadMagic(footerOffset + 16) != "SPHI" || view.ReadUInt32(footerOffset + 12) != Version ||
+            indexOffset < HeaderSize || indexOffset + frameCount * EntrySize != footerOffset)
+        {
+            return false;
+        }
+
+        for (long i = 0; i < frameCount; i++)
+        {
+            long entryOffset = indexOffset + i * EntrySize;
+            uint frameIndex = view.ReadUInt32(entryOffset);
+            long offset = view.ReadInt64(entryOffset + 8);
+            long frameSize = view.ReadInt64(entryOffset + 16);
+            if (offset < HeaderSize || frameSize < FrameHeaderSize || offset + frameSize > indexOffset)
+            {
+                throw new InvalidDataException(path + " has a broken index");
+            }
+            frameOffsets[frameIndex] = offset;
+            frameSizes[frameIndex] = frameSize;
+        }
+        return true;
+    }
+
+    private void RebuildIndex(uint alignment)
+    {
+        if (alignment == 0)
+        {
+            throw new InvalidDataException(path + " has no frame alignment");
+        }
+        long offset = Align(HeaderSize, alignment);
+        while (offset + FrameHeaderSize <= size && ReadMagic(offset) == "SPHF")
+        {
+            uint frameIndex = view.ReadUInt32(offset + 8);
+            long frameSize = view.ReadInt64(offset + 32) + view.ReadUInt32(offset + 44);
+            if (frameSize < FrameHeaderSize || offset + frameSize > size)
+            {
+                // A frame cut short by the end of the file.
+                break;
+            }
+            frameOffsets[frameIndex] = offset;
+            frameSizes[frameIndex] = frameSize;
+            offset = Align(offset + frameSize, alignment);
+        }
+    }
+
+    private static long Align(long value, uint alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
@@ -0,0 +1,201 @@
+﻿using System;
+using System.IO;
+
+// Reader for the binary frame files written by the simulation's FrameWriter.
+// Layout (little-endian): a 56 byte header with magic "SPHF", version,
+// frame index, particle count, heightfield resolution, the byte offsets
+// of the two arrays, the height encoding, the size of the height data,
+// the position encoding and the size of the position data, then the
+// position data and the height data.
+//
+// Raw positions are float32 x, y, z triples. Quantised positions need
+// DecodePositions() with a ParticlePositionDecoder before Positions is set.
+//
+// Raw heights are float32 row-major, a keyframe. Tile delta heights hold
+// the keyframe index, tile size, height quantum, dirty tile count, a dirty
+// tile bitmap and int16 deltas against the keyframe for every vertex of
+// each dirty tile. Those frames need DecodeHeights() with the keyframe's
+// heights before Heights is set.
+public class FrameFile
+{
+    public const uint Version = 3;
+
+    public const uint PositionEncodingRaw = 0;
+    public const uint PositionEncodingQuantised = 1;
+
+    public const uint HeightEncodingRaw = 0;
+    public const uint HeightEncodingTileDeltas = 1;
+
+    public uint FrameIndex;
+    public int ParticleCount;
+    public int ResolutionX;
+    public int ResolutionZ;
+    public uint PositionEncoding;
+    // Quantised position payload, null for raw positions.
+    public byte[] PositionData;
+    // Null until the positions are decoded.
+    public float[] Positions;
+    public uint HeightEncoding;
+    // Frame index of the keyframe the heights are relative to, FrameIndex
+    // for keyframes.
+    public uint KeyframeIndex;
+    // Null until the heights are decoded.
+    public float[] Heights;
+
+    private byte[] heightData;
+
+    public bool IsKeyframe
+    {
+        get { return HeightEncoding == HeightEncodingRaw; }
+    }
+
+    public static FrameFile Load(string path)
+    {
+        using (Stream stream = File.OpenRead(path))
+        {
+            return Read(stream, path);
+        }
+    }
+
+    // Reads a frame that starts at position 0 of stream, path is used in errors.
+    public static FrameFile Read(Stream stream, string path)
+    {
+        using (BinaryReader reader = new BinaryReader(stream, System.Text.Encoding.UTF8, true))
+        {
+            byte[] magic = reader.ReadBytes(4);
+            if (magic.Length != 4 || magic[0] != 'S' || magic[1] != 'P' || magic[2] != 'H' || magic[3] != 'F')
+            {
+                throw new InvalidDataException(path + " is not a frame file");
+            }
+            uint version = reader.ReadUInt32();
+            if (version != Version)
+            {
+                throw new InvalidDataException(path + " has unsupported version " + version.ToString());
+            }
+
+            FrameFile frame = new FrameFile();
+            frame.FrameIndex = reader.ReadUInt32();
+            frame.ParticleCount = (int)reader.ReadUInt32();
+            frame.ResolutionX = (int)reader.ReadUInt32();
+            frame.ResolutionZ = (int)reader.ReadUInt32();
+            long positionsOffset = (long)reader.ReadUInt64();
+            long heightsOffset = (long)reader.ReadUInt64();
+            frame.HeightEncoding = reader.ReadUInt32();
+            int heightsSize = (int)reader.ReadUInt32();
+            frame.PositionEncoding = reader.ReadUInt32();
+            int positionsSize = (int)reader.ReadUInt32();
+
+            if (frame.PositionEncoding == PositionEncodingRaw)
+            {
+                frame.Positions = ReadFloats(reader, positionsOffset, frame.ParticleCount * 3);
+            }
+            else if (frame.PositionEncoding == PositionEncodingQuantised)
+            {
+                reader.BaseStream.Seek(positionsOffset, SeekOrigin.Begin);
+                frame.PositionData = reader.ReadBytes(positionsSize);
+                if (frame.PositionData.Length != positionsSize)
+                {
+                    throw new EndOfStreamException("frame file is truncated");
+                }
+            }
+            else
+            {
+                throw new InvalidDataException(path + " has unsupported position encoding " + frame.PositionEncoding.ToString());
+            }
+            if (frame.HeightEncoding == HeightEncodingRaw)
+            {
+                frame.KeyframeIndex = frame.FrameIndex;
+                frame.Heights = ReadFloats(reader, heightsOffset, frame.ResolutionX * frame.ResolutionZ);
+            }
+            else if (frame.HeightEncoding == HeightEncodingTileDeltas)
+            {
+                reader.BaseStream.Seek(heightsOffset, SeekOrigin.Begin);
+                frame.heightData = reader.ReadBytes(heightsSize);
+                if (frame.heightData.Length != heightsSize || heightsSize < 16)
+                {
+                    throw new EndOfStreamException("frame file is truncated");
+                }
+                frame.KeyframeIndex = BitConverter.ToUInt32(frame.heightData, 0);
+            }
+            else
+            {
+                throw new InvalidDataException(path + " has unsupported height encoding " + frame.HeightEncoding.ToString());
+            }
+            return frame;
+        }
+    }
+
+    // Sets Positions through decoder. Returns false if the positions are
+    // relative to a frame the decoder has not decoded last.
+    public bool DecodePositions(ParticlePositionDecoder decoder)
+    {
+        if (Positions != null)
+        {
+            return true;
+        }
+        float[] positions = decoder.Decode(PositionData);
+        if (positions == null)
+        {
+            return false;
+        }
+        Positions = positions;
+        return true;
+    }
+
+    // Sets Heights from the heights of the keyframe at KeyframeIndex.
+    public void DecodeHeights(float[] keyframeHeights)
+    {
+        if (Heights != null)
+        {
+            return;
+        }
+        if (keyframeHeights.Length != ResolutionX * ResolutionZ)
+        {
+            throw new InvalidDataException("keyframe resolution does not match frame " + FrameIndex.ToString());
+        }
+
+        int tileSize = (int)BitConverter.ToUInt32(heightData, 4);
+        float quantum = BitConverter.ToSingle(heightData, 8);
+        int tilesX = (ResolutionX + tileSize - 1) / tileSize;
+        int tilesZ = (ResolutionZ + tileSize - 1) / tileSize;
+        int bitmapOffset = 16;
+        int deltaOffset = bitmapOffset + (tilesX * tilesZ + 7) / 8;
+
+        float[] heights = (float[])keyframeHeights.Clone();
+        for (int t = 0; t < tilesX * tilesZ; t++)
+        {
+            if ((heightData[bitmapOffset + t / 8] & (1 << (t % 8))) == 0)
+            {
+                continue;
+            }
+            int beginX = (t % tilesX) * tileSize;
+            int beginZ = (t / tilesX) * tileSize;
+            int endX = Math.Min(beginX + tileSize, ResolutionX);
+            int endZ = Math.Min(beginZ + tileSize, ResolutionZ);
+            for (int z = beginZ; z < endZ; z++)
+            {
+                for (int x = beginX; x < endX; x++)
+                {
+                    int node = z * ResolutionX + x;
+                    heights[node] = keyframeHeights[node] + quantum * BitConverter.ToInt16(heightData, deltaOffset);
+                    deltaOffset += sizeof(short);
+                }
+            }
+        }
+        Heights = heights;
+        heightData = null;
+    }
+
+    private static float[] ReadFloats(BinaryReader reader, long offset, int count)
+    {
+        reader.BaseStream.Seek(offset, SeekOrigin.Begin);
+        byte[] bytes = reader.ReadBytes(count * sizeof(float));
+        if (bytes.Length != count * sizeof(float))
+        {
+            throw new EndOfStreamException("frame file is truncated");
+        }
+        float[] values = new float[count];
+        Buffer.BlockCopy(bytes, 0, values, 0, bytes.Length);
+        return values;
+    }
+}
@@ -0,0 +1,134 @@
+﻿using System;
+using System.IO;
+
+// Decoder for the quantised particle positions written by the simulation's
+// ParticlePositionEncoder. A payload starts with the frame index, keyframe
+// index, reference frame index, particle count, float32 x, y, z origin and
+// float32 x, y, z step. Keyframes follow with uint16 x, y, z values.
+// Other frames follow with one Rice parameter per axis, a padding byte and
+// a bit stream of zigzag mapped, Rice coded changes against the reference
+// frame. A position is origin + step * value.
+//
+// Frames decode in order from their keyframe. To seek, decode the keyframe
+// at KeyframeIndexOf() and every frame after it up to the target.
+public class ParticlePositionDecoder
+{
+    public const int HeaderSize = 40;
+
+    private const int MaxRiceQuotient = 32;
+    private const int EscapeBits = 17;
+
+    private bool hasFrame;
+    private uint frameIndex;
+    private ushort[] values = new ushort[0];
+
+    public bool HasFrame
+    {
+        get { return hasFrame; }
+    }
+
+    public uint FrameIndex
+    {
+        get { return frameIndex; }
+    }
+
+    public void Reset()
+    {
+        hasFrame = false;
+    }
+
+    public static uint KeyframeIndexOf(byte[] data)
+    {
+        return BitConverter.ToUInt32(data, 4);
+    }
+
+    // Returns true if data is a keyframe or relative to the last decoded frame.
+    public bool CanDecode(byte[] data)
+    {
+        if (data.Length < HeaderSize)
+        {
+            return false;
+        }
+        uint index = BitConverter.ToUInt32(data, 0);
+        uint keyframeIndex = BitConverter.ToUInt32(data, 4);
+        uint referenceIndex = BitConverter.ToUInt32(data, 8);
+        int particleCount = (int)BitConverter.ToUInt32(data, 12);
+        return index == keyframeIndex ||
+            (hasFrame && referenceIndex == frameIndex && particleCount * 3 == values.Length);
+    }
+
+    // Returns x, y, z positions, or null if the frame cannot be decoded.
+    public float[] Decode(byte[] data)
+    {
+        if (!CanDecode(data))
+        {
+            return null;
+        }
+        uint index = BitConverter.ToUInt32(data, 0);
+        bool isKeyframe = index == KeyframeIndexOf(data);
+        int count = (int)BitConverter.ToUInt32(data, 12) * 3;
+
+        ushort[] decoded = new ushort[count];
+        if (isKeyframe)
+        {
+            if (data.Length != HeaderSize + count * sizeof(ushort))
+            {
+                throw new InvalidDataException("quantised positions have the wrong size");
+            }
+            Buffer.BlockCopy(data, HeaderSize, decoded, 0, count * sizeof(ushort));
+        }
+        else
+        {
+            int[] riceParameters = { data[HeaderSize], data[HeaderSize + 1], data[HeaderSize + 2] };
+            int bitOffset = (HeaderSize + 4) * 8;
+            for (int i = 0; i < count; i++)
+            {
+                uint change = ReadRice(data, ref bitOffset, riceParameters[i % 3]);
+                int signedChange = (int)(change >> 1) ^ -(int)(change & 1);
+                decoded[i] = (ushort)(values[i] + signedChange);
+            }
+        }
+
+        values = decoded;
+        frameIndex = index;
+        hasFrame = true;
+
+        float[] positions = new float[count];
+        for (int i = 0; i < count; i++)
+        {
+            int axis = i % 3;
+            float origin = BitConverter.ToSingle(data, 16 + 4 * axis);
+            float step = BitConverter.ToSingle(data, 28 + 4 * axis);
+            positions[i] = origin + step * values[i];
+        }
+        return positions;
+    }
+
+    private static uint ReadBits(byte[] data, ref int bitOffset, int count)
+    {
+        uint bits = 0;
+        for (int i = 0; i < count; i++, bitOffset++)
+        {
+            int byteIndex = bitOffset >> 3;
+            if (byteIndex >= data.Length)
+            {
+                throw new EndOfStreamException("quantised positions are truncated");
+            }
+            bits |= (uint)((data[byteIndex] >> (bitOffset & 7)) & 1) << i;
+        }
+        return bits;
+    }
+
+    private static uint ReadRice(byte[] data, ref int bitOffset, int k)
+    {
+        uint quotient = 0;
+        while (ReadBits(data, ref bitOffset, 1) == 1)
+        {
+            if (++quotient == MaxRiceQuotient)
+            {
+                return ReadBits(data, ref bitOffset, EscapeBits);
+            }
+        }
+        return (quotient << k) | ReadBits(data, ref bitOffset, k);
+    }
+}
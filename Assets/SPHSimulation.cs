@@ -6,14 +6,14 @@ using System.IO;
 public class SPHSimulation : MonoBehaviour
 {
     [SerializeField] private GameObject sphere;
-    private StreamReader File;
-    private string text;
     private GameObject[] particles;
     private int frame = 0;
     public int particleCount;
     private float timer = 0.0f;
     [SerializeField] public int frameCount;
     float fps = 1 / 15;
+    private ParticlePositionDecoder positionDecoder = new ParticlePositionDecoder();
+    private FrameArchive archive;
 
 
     // Start is called before the first frame update
@@ -26,13 +26,7 @@ public class SPHSimulation : MonoBehaviour
             particles[i] = Instantiate(sphere);
         }
 
-        File = new StreamReader("Assets/Positions/DamBreak" + frame.ToString() + ".txt");
-        text = File.ReadToEnd();
-        string[] xyz = text.Split(',');
-        for (long i = 0; i < particles.Length; i++)
-        {
-            particles[i].transform.position = new Vector3(float.Parse(xyz[i * 3]), float.Parse(xyz[i * 3 + 1]), float.Parse(xyz[i * 3 + 2]));
-        }
+        LoadFrame(frame);
         frame++;
 
     }
@@ -45,13 +39,7 @@ public class SPHSimulation : MonoBehaviour
             timer += Time.deltaTime;
             if (timer >= fps)
             {
-                File = new StreamReader("Assets/Positions/DamBreak" + frame.ToString() + ".txt");
-                text = File.ReadToEnd();
-                string[] xyz = text.Split(',');
-                for (long i = 0; i < particles.Length; i++)
-                {
-                    particles[i].transform.position = new Vector3(float.Parse(xyz[i * 3]), float.Parse(xyz[i * 3 + 1]), float.Parse(xyz[i * 3 + 2]));
-                }
+                LoadFrame(frame);
                 frame++;
 
                 timer = 0.0f;
@@ -62,4 +50,48 @@ public class SPHSimulation : MonoBehaviour
             frame = 1;
         }
     }
+
+    private void LoadFrame(int index)
+    {
+        FrameFile frameFile = LoadFrameFile(index);
+        if (!frameFile.DecodePositions(positionDecoder))
+        {
+            // Seeking, decode forward from the frame's keyframe.
+            int keyframeIndex = (int)ParticlePositionDecoder.KeyframeIndexOf(frameFile.PositionData);
+            for (int i = keyframeIndex; i < index; i++)
+            {
+                LoadFrameFile(i).DecodePositions(positionDecoder);
+            }
+            frameFile.DecodePositions(positionDecoder);
+        }
+        float[] xyz = frameFile.Positions;
+        int count = Mathf.Min(particles.Length, frameFile.ParticleCount);
+        for (int i = 0; i < count; i++)
+        {
+            particles[i].transform.position = new Vector3(xyz[i * 3], xyz[i * 3 + 1], xyz[i * 3 + 2]);
+        }
+    }
+
+    private FrameFile LoadFrameFile(int index)
+    {
+        // Prefer the single-file archive, without one every frame has its own file.
+        if (archive == null && File.Exists(FrameArchive.DefaultPath))
+        {
+            archive = FrameArchive.Open(FrameArchive.DefaultPath);
+        }
+        if (archive != null)
+        {
+            return archive.Load(index);
+        }
+        return FrameFile.Load("Assets/Positions/Frame" + index.ToString() + ".bin");
+    }
+
+    void OnDestroy()
+    {
+        if (archive != null)
+        {
+            archive.Dispose();
+            archive = null;
+        }
+    }
 }
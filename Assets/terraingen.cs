@@ -14,8 +14,6 @@ public class terraingen : MonoBehaviour
     public int width = 100;
     public int depth = 100;
     
-    private StreamReader File;
-    private string text;
     public int frame = 0;
     private float timer = 0.0f;
     [SerializeField] private int frameCount;
@@ -23,6 +21,11 @@ public class terraingen : MonoBehaviour
 
     public bool updateMesh = false;
 
+    // Heights of the last keyframe, delta frames are decoded against it.
+    private uint keyframeIndex;
+    private float[] keyframeHeights;
+    private FrameArchive archive;
+
     // Start is called before the first frame update
     void Start()
     {
@@ -64,13 +67,7 @@ public class terraingen : MonoBehaviour
             {
                 if (frame > 1)
                 {
-                    File = new StreamReader("Assets/Positions/Mesh" + frame.ToString() + ".txt");
-                    text = File.ReadToEnd();
-                    string[] xyz = text.Split(',');
-                    for (long i = 0; i < vertices.Length; i++)
-                    {
-                        vertices[i] = new Vector3(float.Parse(xyz[i * 3]), float.Parse(xyz[i * 3 + 1]), float.Parse(xyz[i * 3 + 2]));
-                    }
+                    LoadHeights(frame);
                 }
                 frame++;
                 if(frame == frameCount)
@@ -104,6 +101,59 @@ public class terraingen : MonoBehaviour
         //}
     }
 
+    private void LoadHeights(int index)
+    {
+        // Frame files only store heights, x and z follow from the grid index.
+        FrameFile frameFile = LoadFrameFile(index);
+        if (frameFile.IsKeyframe)
+        {
+            keyframeIndex = frameFile.FrameIndex;
+            keyframeHeights = frameFile.Heights;
+        }
+        else
+        {
+            // Seeking past a keyframe loads the one this frame refers to.
+            if (keyframeHeights == null || keyframeIndex != frameFile.KeyframeIndex)
+            {
+                keyframeIndex = frameFile.KeyframeIndex;
+                keyframeHeights = LoadFrameFile((int)keyframeIndex).Heights;
+            }
+            frameFile.DecodeHeights(keyframeHeights);
+        }
+
+        int resolutionX = frameFile.ResolutionX;
+        int count = Mathf.Min(vertices.Length, frameFile.Heights.Length);
+        for (int i = 0; i < count; i++)
+        {
+            int x = i % resolutionX;
+            int z = i / resolutionX;
+            vertices[i] = new Vector3(x - resolutionX / 2.0f, frameFile.Heights[i], z - frameFile.ResolutionZ / 2.0f);
+        }
+    }
+
+    private FrameFile LoadFrameFile(int index)
+    {
+        // Prefer the single-file archive, without one every frame has its own file.
+        if (archive == null && File.Exists(FrameArchive.DefaultPath))
+        {
+            archive = FrameArchive.Open(FrameArchive.DefaultPath);
+        }
+        if (archive != null)
+        {
+            return archive.Load(index);
+        }
+        return FrameFile.Load("Assets/Positions/Frame" + index.ToString() + ".bin");
+    }
+
+    void OnDestroy()
+    {
+        if (archive != null)
+        {
+            archive.Dispose();
+            archive = null;
+        }
+    }
+
     private void resetMesh()
     {
         StreamReader File = new StreamReader("Assets/Positions/Mesh.txt");
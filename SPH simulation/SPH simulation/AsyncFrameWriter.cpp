@@ -0,0 +1,172 @@
+#include "AsyncFrameWriter.h"
+
+#include <algorithm>
+
+#include "Timer.h"
+
+AsyncFrameWriter::AsyncFrameWriter(size_t numberOfBuffers)
+	: _snapshots(std::max(numberOfBuffers, static_cast<size_t>(1)))
+{
+	for (size_t i = 0; i < _snapshots.size(); ++i)
+	{
+		_freeBuffers.push_back(i);
+	}
+	_thread = std::thread([this]() { writerLoop(); });
+}
+
+AsyncFrameWriter::~AsyncFrameWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_isStopping = true;
+	}
+	_hasWork.notify_all();
+	_thread.join();
+}
+
+void AsyncFrameWriter::setOffset(const Vector3 & offset)
+{
+	_writer.setOffset(offset);
+}
+
+void AsyncFrameWriter::submitFrame(
+	const std::string & filename,
+	uint32_t frameIndex,
+	const std::vector<Vector3>& positions,
+	const std::vector<Vector3>& vertices,
+	size_t resolutionX,
+	size_t resolutionZ)
+{
+	size_t buffer = acquireBuffer();
+	// The buffer is owned by this thread until it is queued.
+	_writer.makeSnapshot(frameIndex, positions, vertices, resolutionX, resolutionZ, &_snapshots[buffer]);
+	queueBuffer(filename, buffer);
+}
+
+void AsyncFrameWriter::submitFrame(
+	const std::string & filename,
+	uint32_t frameIndex,
+	const std::vector<Vector3>& positions,
+	Heightfield & heightfield)
+{
+	size_t buffer = acquireBuffer();
+	_writer.makeSnapshot(frameIndex, positions, heightfield, &_snapshots[buffer]);
+	queueBuffer(filename, buffer);
+}
+
+FrameWriter & AsyncFrameWriter::frameWriter()
+{
+	return _writer;
+}
+
+size_t AsyncFrameWriter::acquireBuffer()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	if (_freeBuffers.empty())
+	{
+		Timer timer;
+		_bufferFreed.wait(lock, [this]() { return !_freeBuffers.empty(); });
+		_stallTimeInSeconds += timer.durationInSeconds();
+		++_numberOfStalls;
+	}
+	size_t buffer = _freeBuffers.back();
+	_freeBuffers.pop_back();
+	return buffer;
+}
+
+void AsyncFrameWriter::queueBuffer(const std::string & filename, size_t buffer)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_queue.push_back(Job{ filename, buffer });
+		_peakQueueDepth = std::max(_peakQueueDepth, _snapshots.size() - _freeBuffers.size());
+	}
+	_hasWork.notify_one();
+}
+
+void AsyncFrameWriter::flush()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_bufferFreed.wait(lock, [this]() { return _freeBuffers.size() == _snapshots.size(); });
+}
+
+bool AsyncFrameWriter::openArchive(const std::string & filename)
+{
+	flush();
+	return _archive.open(filename);
+}
+
+bool AsyncFrameWriter::closeArchive()
+{
+	flush();
+	return _archive.close();
+}
+
+size_t AsyncFrameWriter::numberOfBuffers() const
+{
+	return _snapshots.size();
+}
+
+size_t AsyncFrameWriter::peakQueueDepth() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _peakQueueDepth;
+}
+
+size_t AsyncFrameWriter::numberOfStalls() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _numberOfStalls;
+}
+
+double AsyncFrameWriter::stallTimeInSeconds() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _stallTimeInSeconds;
+}
+
+size_t AsyncFrameWriter::numberOfWrittenFrames() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _numberOfWrittenFrames;
+}
+
+size_t AsyncFrameWriter::numberOfFailedFrames() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _numberOfFailedFrames;
+}
+
+void AsyncFrameWriter::writerLoop()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true)
+	{
+		_hasWork.wait(lock, [this]() { return _isStopping || !_queue.empty(); });
+		if (_queue.empty())
+		{
+			// Stopping, and everything queued has been written.
+			return;
+		}
+
+		Job job = _queue.front();
+		_queue.pop_front();
+
+		lock.unlock();
+		bool isWritten = _archive.isOpen()
+			? _archive.appendSnapshot(_snapshots[job.buffer])
+			: _writer.writeSnapshot(job.filename, _snapshots[job.buffer]);
+		lock.lock();
+
+		if (isWritten)
+		{
+			++_numberOfWrittenFrames;
+		}
+		else
+		{
+			++_numberOfFailedFrames;
+		}
+		_freeBuffers.push_back(job.buffer);
+		_bufferFreed.notify_all();
+	}
+}
@@ -0,0 +1,135 @@
+#pragma once
+#ifndef INCLUDE_ASYNC_FRAME_WRITER_H_
+#define INCLUDE_ASYNC_FRAME_WRITER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FrameArchive.h"
+#include "FrameWriter.h"
+
+//!
+//! \brief Writes frame files on a background thread.
+//!
+//! submitFrame() converts the frame into one of a fixed pool of snapshot
+//! buffers and queues it, then returns. A worker thread writes queued
+//! snapshots in submission order and hands the buffers back. The caller
+//! only blocks when every buffer is still queued or being written. Two
+//! buffers give double buffering. More buffers absorb slow disks, and the
+//! reported peak queue depth and stall time show how many are needed.
+//! With an archive open, frames are appended to it instead of being
+//! written to their own files.
+//!
+class AsyncFrameWriter
+{
+public:
+	//! Starts the writer thread with \p numberOfBuffers snapshot buffers.
+	explicit AsyncFrameWriter(size_t numberOfBuffers = 2);
+
+	//! Writes all queued frames, then stops the writer thread.
+	~AsyncFrameWriter();
+
+	AsyncFrameWriter(const AsyncFrameWriter&) = delete;
+	AsyncFrameWriter& operator=(const AsyncFrameWriter&) = delete;
+
+	//! Sets the offset added to every exported position and height. Only
+	//! call this while no frame is being submitted.
+	void setOffset(const Vector3& offset);
+
+	//! Converts a frame into a free buffer and queues it for \p filename.
+	//! Blocks while no buffer is free.
+	void submitFrame(
+		const std::string& filename,
+		uint32_t frameIndex,
+		const std::vector<Vector3>& positions,
+		const std::vector<Vector3>& vertices,
+		size_t resolutionX,
+		size_t resolutionZ);
+
+	//! Same as above, with heights taken from \p heightfield through
+	//! FrameWriter::makeSnapshot().
+	void submitFrame(
+		const std::string& filename,
+		uint32_t frameIndex,
+		const std::vector<Vector3>& positions,
+		Heightfield& heightfield);
+
+	//! Returns the writer that converts frames, to configure the height
+	//! encoding. Only call this while no frame is being submitted.
+	FrameWriter& frameWriter();
+
+	//! Blocks until every queued frame has been written.
+	void flush();
+
+	//!
+	//! \brief Writes later frames to the archive \p filename.
+	//!
+	//! Frames submitted while the archive is open are appended to it and
+	//! their filenames are ignored. Returns false if the archive could not
+	//! be created. Only call this while no frame is being submitted.
+	//!
+	bool openArchive(const std::string& filename);
+
+	//! Writes the queued frames and the archive index, then goes back to
+	//! one file per frame. Returns false if any archive write failed.
+	bool closeArchive();
+
+	//! Returns the number of snapshot buffers.
+	size_t numberOfBuffers() const;
+
+	//! Returns the largest number of frames that were queued or being
+	//! written at once.
+	size_t peakQueueDepth() const;
+
+	//! Returns how many submitFrame() calls had to wait for a buffer.
+	size_t numberOfStalls() const;
+
+	//! Returns the total time submitFrame() spent waiting for a buffer.
+	double stallTimeInSeconds() const;
+
+	//! Returns the number of frames written successfully.
+	size_t numberOfWrittenFrames() const;
+
+	//! Returns the number of frames whose file could not be written.
+	size_t numberOfFailedFrames() const;
+
+private:
+	struct Job
+	{
+		std::string filename;
+		size_t buffer;
+	};
+
+	FrameWriter _writer;
+	FrameArchiveWriter _archive;
+	std::vector<FrameSnapshot> _snapshots;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _hasWork;
+	std::condition_variable _bufferFreed;
+	std::deque<Job> _queue;
+	std::vector<size_t> _freeBuffers;
+	bool _isStopping = false;
+
+	size_t _peakQueueDepth = 0;
+	size_t _numberOfStalls = 0;
+	double _stallTimeInSeconds = 0.0;
+	size_t _numberOfWrittenFrames = 0;
+	size_t _numberOfFailedFrames = 0;
+
+	std::thread _thread;
+
+	void writerLoop();
+
+	//! Waits for a free buffer and returns it.
+	size_t acquireBuffer();
+
+	//! Queues a filled buffer for the writer thread.
+	void queueBuffer(const std::string& filename, size_t buffer);
+};
+
+#endif
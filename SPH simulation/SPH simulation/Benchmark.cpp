@@ -0,0 +1,377 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+
+#include "BccLatticePointGenerator.h"
+#include "BoundingBox.h"
+#include "Box.h"
+#include "Frame.h"
+#include "Heightfield.h"
+#include "Parallel.h"
+#include "PciSphSystemSolver.h"
+#include "RigidBodyCollider.h"
+#include "SphStdKernel.h"
+#include "SphSystemData.h"
+#include "Timer.h"
+#include "VolumeParticleEmitter.h"
+
+#ifdef SPH_ALLOCATION_CHECKS
+namespace
+{
+	//! Allocations are only counted while this is set.
+	std::atomic<bool> gIsCountingAllocations(false);
+	std::atomic<size_t> gNumberOfAllocations(0);
+	std::atomic<size_t> gLargestAllocation(0);
+
+	void startCountingAllocations()
+	{
+		gNumberOfAllocations = 0;
+		gLargestAllocation = 0;
+		gIsCountingAllocations = true;
+	}
+
+	void stopCountingAllocations()
+	{
+		gIsCountingAllocations = false;
+	}
+}
+
+//! Counts allocations for checkAllocations(). Every form of operator new
+//! and delete is replaced so that they agree on malloc() and free().
+void* operator new(size_t size)
+{
+	if (gIsCountingAllocations)
+	{
+		++gNumberOfAllocations;
+		size_t largest = gLargestAllocation;
+		while (size > largest && !gLargestAllocation.compare_exchange_weak(largest, size))
+		{
+		}
+	}
+	if (void* memory = std::malloc(size > 0 ? size : 1))
+	{
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+	std::free(memory);
+}
+#endif
+
+void runDensityPassBenchmark(
+	size_t numberOfParticles,
+	double targetSpacing,
+	unsigned int numberOfRepeats)
+{
+	SphSystemData particles;
+	particles.setTargetSpacing(targetSpacing);
+
+	double sideLength = targetSpacing * std::cbrt(static_cast<double>(numberOfParticles));
+	std::vector<Vector3> points;
+	BccLatticePointGenerator pointsGenerator;
+	pointsGenerator.generate(
+		BoundingBox(Vector3(), Vector3(sideLength, sideLength, sideLength)),
+		targetSpacing,
+		&points);
+	particles.addParticles(points);
+	particles.buildNeighbourSearcher();
+
+	const size_t n = particles.numberOfParticles();
+	const double kernelRadius = particles.kernelRadius();
+	const SphStdKernel kernel(kernelRadius);
+	const std::vector<Vector3>& positions = particles.positions();
+	std::vector<double> densities(n);
+
+	// Virtual interface, every visited point goes through std::function.
+	PointNeighbourSearcherPtr searcher = particles.neighborSearcher();
+	Timer timer;
+	for (unsigned int repeat = 0; repeat < numberOfRepeats; ++repeat)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			Vector3 origin = positions[i];
+			double sum = 0.0;
+			searcher->forEachNearbyPoint(origin, kernelRadius,
+				[&](size_t, const Vector3& neighbourPosition)
+			{
+				sum += kernel(origin.distanceTo(neighbourPosition));
+			});
+			densities[i] = particles.mass() * sum;
+		}
+	}
+	double virtualSeconds = timer.durationInSeconds();
+	double virtualChecksum = 0.0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		virtualChecksum += densities[i];
+	}
+
+	// Concrete searcher, the lambda is inlined into the bucket loop.
+	const PointHashGridSearcherPtr& hashGridSearcher = particles.hashGridSearcher();
+	timer.reset();
+	for (unsigned int repeat = 0; repeat < numberOfRepeats; ++repeat)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			Vector3 origin = positions[i];
+			double sum = 0.0;
+			hashGridSearcher->forEachNearbyPoint(origin, kernelRadius,
+				[&](size_t, const Vector3& neighbourPosition)
+			{
+				sum += kernel(origin.distanceTo(neighbourPosition));
+			});
+			densities[i] = particles.mass() * sum;
+		}
+	}
+	double templateSeconds = timer.durationInSeconds();
+	double templateChecksum = 0.0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		templateChecksum += densities[i];
+	}
+
+	printf("Density pass, %zu particles, %u repeats\n", n, numberOfRepeats);
+	printf("  std::function callback: %.3f ms/pass\n", 1000.0 * virtualSeconds / numberOfRepeats);
+	printf("  inlined template:       %.3f ms/pass (%.2fx)\n",
+		1000.0 * templateSeconds / numberOfRepeats,
+		(templateSeconds > 0.0) ? virtualSeconds / templateSeconds : 0.0);
+	if (virtualChecksum != templateChecksum)
+	{
+		printf("  warning: density checksums differ (%.17g vs %.17g)\n",
+			virtualChecksum, templateChecksum);
+	}
+}
+
+namespace
+{
+	//! Fills a cube of roughly \p numberOfParticles lattice particles, each
+	//! with a small random velocity, and the domain around it.
+	void makeParticleBlock(
+		size_t numberOfParticles,
+		double targetSpacing,
+		std::vector<Vector3>* points,
+		std::vector<Vector3>* velocities,
+		BoundingBox* domain)
+	{
+		double sideLength = targetSpacing * std::cbrt(static_cast<double>(numberOfParticles));
+		BccLatticePointGenerator pointsGenerator;
+		pointsGenerator.generate(
+			BoundingBox(Vector3(1, 1, 1), Vector3(1 + sideLength, 1 + sideLength, 1 + sideLength)),
+			targetSpacing,
+			points);
+		const double domainSize = sideLength + 2;
+		domain->lowerCorner = Vector3();
+		domain->upperCorner = Vector3(domainSize, 2 * domainSize, domainSize);
+
+		std::mt19937 random(0);
+		std::uniform_real_distribution<double> jitter(-0.1, 0.1);
+		velocities->resize(points->size());
+		for (auto& velocity : *velocities)
+		{
+			velocity = Vector3(jitter(random), jitter(random), jitter(random));
+		}
+	}
+
+	PciSphSystemSolverPtr makeBlockSolver(
+		const std::vector<Vector3>& points,
+		const std::vector<Vector3>& velocities,
+		const BoundingBox& domain,
+		double targetSpacing)
+	{
+		auto solver = PciSphSystemSolver::Builder()
+			.withTargetDensity(1000)
+			.withTargetSpacing(targetSpacing)
+			.makeShared();
+
+		// The solver collides with a heightfield and respawns lost particles
+		// through its emitter, so the block falls onto flat ground and the
+		// emitter never adds particles of its own.
+		const size_t resolution = static_cast<size_t>(domain.width()) + 3;
+		auto ground = Heightfield::builder()
+			.withHeights(std::vector<double>(resolution * resolution, 0.0))
+			.withResolution(resolution, resolution)
+			.withBox(domain)
+			.makeShared();
+		solver->setCollider(RigidBodyCollider::builder().withSurface(ground).makeShared());
+		auto emitter = VolumeParticleEmitter::builder()
+			.withSurface(Box::builder().withBoundingBox(domain).makeShared())
+			.withMaxRegion(domain)
+			.withSpacing(targetSpacing)
+			.withMaxNumberOfParticles(0)
+			.makeShared();
+		solver->setEmitter(emitter);
+
+		auto particles = solver->sphSystemData();
+		// Sorted as a running simulation keeps them, see damBreakSim().
+		particles->setSpatialSortInterval(10);
+		particles->addParticles(points, velocities);
+		particles->sortParticlesSpatially(particles->kernelRadius());
+		return solver;
+	}
+
+	double runPairForceFrames(
+		bool isUsingHalfNeighbourLists,
+		const std::vector<Vector3>& points,
+		const std::vector<Vector3>& velocities,
+		const BoundingBox& domain,
+		double targetSpacing,
+		int numberOfFrames,
+		double* checksum)
+	{
+		auto solver = makeBlockSolver(points, velocities, domain, targetSpacing);
+		solver->setIsUsingHalfNeighbourLists(isUsingHalfNeighbourLists);
+
+		Timer timer;
+		for (Frame frame(0, 1.0 / 60.0); frame.index < numberOfFrames; ++frame)
+		{
+			solver->Update(frame);
+		}
+		double seconds = timer.durationInSeconds();
+
+		*checksum = 0.0;
+		for (const auto& position : solver->sphSystemData()->positions())
+		{
+			*checksum += position.x + position.y + position.z;
+		}
+		return seconds;
+	}
+}
+
+void runPairForceBenchmark(
+	size_t numberOfParticles,
+	double targetSpacing,
+	int numberOfFrames,
+	unsigned int numberOfTrials)
+{
+	std::vector<Vector3> points, velocities;
+	BoundingBox domain;
+	makeParticleBlock(numberOfParticles, targetSpacing, &points, &velocities, &domain);
+
+	// The modes take turns and the fastest run of each counts, so a busy
+	// machine slows both alike.
+	double halfSeconds = 0.0, fullSeconds = 0.0;
+	double halfChecksum = 0.0, fullChecksum = 0.0;
+	for (unsigned int trial = 0; trial < numberOfTrials; ++trial)
+	{
+		double seconds = runPairForceFrames(
+			true, points, velocities, domain, targetSpacing, numberOfFrames, &halfChecksum);
+		halfSeconds = (trial == 0) ? seconds : std::min(halfSeconds, seconds);
+		seconds = runPairForceFrames(
+			false, points, velocities, domain, targetSpacing, numberOfFrames, &fullChecksum);
+		fullSeconds = (trial == 0) ? seconds : std::min(fullSeconds, seconds);
+	}
+
+	printf("Pair force passes, %zu particles, %d frames, best of %u, %u threads\n",
+		points.size(), numberOfFrames, numberOfTrials, maxNumberOfThreads());
+	printf("  full neighbour lists: %.3f ms/frame\n", 1000.0 * fullSeconds / numberOfFrames);
+	printf("  half neighbour lists: %.3f ms/frame (%.2fx)\n",
+		1000.0 * halfSeconds / numberOfFrames,
+		(halfSeconds > 0.0) ? fullSeconds / halfSeconds : 0.0);
+	printf("  position checksums: %.17g vs %.17g\n", halfChecksum, fullChecksum);
+}
+
+#ifdef SPH_ALLOCATION_CHECKS
+bool checkAllocations(size_t numberOfParticles, double targetSpacing)
+{
+	std::vector<Vector3> points, velocities;
+	BoundingBox domain;
+	makeParticleBlock(numberOfParticles, targetSpacing, &points, &velocities, &domain);
+	auto solver = makeBlockSolver(points, velocities, domain, targetSpacing);
+	auto particles = solver->sphSystemData();
+
+	// Anything as large as a per-particle array of doubles is a copy of one.
+	const size_t n = particles->numberOfParticles();
+	const size_t arraySize = n * sizeof(double);
+	bool isPassing = true;
+
+	// Per-particle accessors.
+	particles->buildNeighbourSearcher();
+	particles->buildNeighbourLists();
+	particles->updateDensities();
+	const std::vector<double>& values = particles->densities();
+	const std::vector<Vector3>& positions = particles->positions();
+	const std::vector<Vector3>& vectorValues = particles->velocities();
+	double checksum = 0.0;
+
+	startCountingAllocations();
+	for (size_t i = 0; i < n; ++i)
+	{
+		checksum += particles->gradientAt(i, values).x;
+		checksum += particles->laplacianAt(i, values);
+		checksum += particles->interpolate(positions[i], vectorValues).x;
+		checksum += particles->interpolate(positions[i]);
+	}
+	stopCountingAllocations();
+
+	printf("Allocations, %zu particles (checksum %g)\n", n, checksum);
+	printf("  accessors: %zu allocations, largest %zu bytes\n",
+		gNumberOfAllocations.load(), gLargestAllocation.load());
+	if (gLargestAllocation >= arraySize)
+	{
+		printf("  FAILED: an accessor copied a per-particle array\n");
+		isPassing = false;
+	}
+
+	// Solver frames, once the scratch buffers have grown to the particle
+	// count. The forces and viscosity passes must neither copy particle
+	// arrays nor grow scratch buffers.
+	Frame frame(0, 1.0 / 60.0);
+	for (; frame.index < 2; ++frame)
+	{
+		solver->Update(frame);
+	}
+	const size_t numberOfScratchAllocations = solver->numberOfScratchAllocations();
+
+	startCountingAllocations();
+	for (; frame.index < 4; ++frame)
+	{
+		solver->Update(frame);
+	}
+	stopCountingAllocations();
+
+	printf("  solver frames: %zu allocations, largest %zu bytes, %zu scratch buffer growths\n",
+		gNumberOfAllocations.load(), gLargestAllocation.load(),
+		solver->numberOfScratchAllocations() - numberOfScratchAllocations);
+	if (gLargestAllocation >= arraySize)
+	{
+		printf("  FAILED: a solver frame allocated a per-particle array\n");
+		isPassing = false;
+	}
+	if (solver->numberOfScratchAllocations() != numberOfScratchAllocations)
+	{
+		printf("  FAILED: a solver frame grew a scratch buffer\n");
+		isPassing = false;
+	}
+	return isPassing;
+}
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+#ifndef INCLUDE_BENCHMARK_H_
+#define INCLUDE_BENCHMARK_H_
+
+#include <cstddef>
+
+//!
+//! \brief Times the SPH density pass through both neighbour search paths.
+//!
+//! Fills a cube with roughly \p numberOfParticles lattice particles at
+//! \p targetSpacing and runs the density sum \p numberOfRepeats times, once
+//! through the virtual std::function PointNeighbourSearcher interface and
+//! once through the inlinable PointHashGridSearcher::forEachNearbyPoint()
+//! template. Prints both timings.
+//!
+void runDensityPassBenchmark(
+	size_t numberOfParticles,
+	double targetSpacing,
+	unsigned int numberOfRepeats);
+
+//!
+//! \brief Times PCISPH frames with half and full neighbour lists.
+//!
+//! Fills a cube with roughly \p numberOfParticles lattice particles at
+//! \p targetSpacing, each with a small random velocity so the viscosity
+//! pass has velocity differences to smooth, above flat ground. Runs
+//! \p numberOfFrames frames from that state with the symmetric half list
+//! passes and with the full list passes, \p numberOfTrials times each, on
+//! maxNumberOfThreads() threads. Prints the fastest timing of each.
+//!
+void runPairForceBenchmark(
+	size_t numberOfParticles,
+	double targetSpacing,
+	int numberOfFrames,
+	unsigned int numberOfTrials);
+
+#ifdef SPH_ALLOCATION_CHECKS
+//!
+//! \brief Checks that per-particle work does not copy particle arrays.
+//!
+//! Counts every operator new while calling SphSystemData::gradientAt(),
+//! laplacianAt() and interpolate() for each of roughly
+//! \p numberOfParticles particles, and while running PCISPH frames once
+//! the solver's scratch buffers have grown. Fails if any allocation is
+//! the size of a per-particle array or if
+//! ParticleSystemSolver::numberOfScratchAllocations() still grows. Prints
+//! the counts and returns true if the check passes.
+//!
+//! Only built when SPH_ALLOCATION_CHECKS is defined, because counting
+//! replaces the global operator new and delete of the whole program.
+//!
+bool checkAllocations(size_t numberOfParticles, double targetSpacing);
+#endif
+
+#endif
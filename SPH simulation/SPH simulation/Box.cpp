@@ -191,4 +191,65 @@ BoxPtr Box::Builder::makeShared() const
 	return std::shared_ptr<Box>(
 		new Box(_lowerCorner, _upperCorner, _transform, _isNormalFlipped),
 		[](Box* obj) { delete obj; });
-}
\ No newline at end of file
+}
+
+SurfaceQueryResult Box::closestQueryLocal(const Vector3 & otherPoint)
+{
+	Plane planes[6] = { Plane(Vector3(1, 0, 0), bound.upperCorner),
+					   Plane(Vector3(0, 1, 0), bound.upperCorner),
+					   Plane(Vector3(0, 0, 1), bound.upperCorner),
+					   Plane(Vector3(-1, 0, 0), bound.lowerCorner),
+					   Plane(Vector3(0, -1, 0), bound.lowerCorner),
+					   Plane(Vector3(0, 0, -1), bound.lowerCorner) };
+
+	SurfaceQueryResult result;
+	if (bound.contains(otherPoint))
+	{
+		// Inside, the closest face gives both the point and the normal.
+		result.point = planes[0].closestPoint(otherPoint);
+		result.normal = planes[0].normal;
+		double minDistanceSquared = result.point.distanceSquaredTo(otherPoint);
+
+		for (int i = 1; i < 6; ++i)
+		{
+			Vector3 localClosestPoint = planes[i].closestPoint(otherPoint);
+			double localDistanceSquared = localClosestPoint.distanceSquaredTo(otherPoint);
+
+			if (localDistanceSquared < minDistanceSquared)
+			{
+				result.point = localClosestPoint;
+				result.normal = planes[i].normal;
+				minDistanceSquared = localDistanceSquared;
+			}
+		}
+	}
+	else
+	{
+		result.point = Vector3(
+			std::max(otherPoint.x, bound.lowerCorner.x),
+			std::max(otherPoint.y, bound.lowerCorner.y),
+			std::max(otherPoint.z, bound.lowerCorner.z));
+		result.point = Vector3(
+			std::min(result.point.x, bound.upperCorner.x),
+			std::min(result.point.y, bound.upperCorner.y),
+			std::min(result.point.z, bound.upperCorner.z));
+		Vector3 closestPointToInputPoint = otherPoint - result.point;
+		result.normal = planes[0].normal;
+		double maxCosineAngle = result.normal.dot(closestPointToInputPoint);
+
+		for (int i = 1; i < 6; ++i)
+		{
+			double cosineAngle = planes[i].normal.dot(closestPointToInputPoint);
+
+			if (cosineAngle > maxCosineAngle)
+			{
+				result.normal = planes[i].normal;
+				maxCosineAngle = cosineAngle;
+			}
+		}
+	}
+
+	result.distance = otherPoint.distanceTo(result.point);
+	result.isInside = (otherPoint - result.point).dot(result.normal) < 0.0;
+	return result;
+}
@@ -45,6 +45,9 @@ protected:
 	BoundingBox boundingBoxLocal() const override;
 
 	Vector3 closestNormalLocal(const Vector3& otherPoint) const override;
+
+	//! Finds the closest face once for all four results.
+	SurfaceQueryResult closestQueryLocal(const Vector3& otherPoint) override;
 };
 
 //! Shared pointer type for the Box3.
@@ -1,6 +1,13 @@
 #include "Collider.h"
+#include "Parallel.h"
 #include <algorithm>
 
+namespace
+{
+	//! Points per Surface::closestQueries() call in resolveCollisions().
+	const size_t kCollisionBatchSize = 64;
+}
+
 
 Collider::Collider()
 {
@@ -15,7 +22,36 @@ void Collider::resolveCollision(double radius, double restitutionCoefficient, Ve
 {
 	ColliderQueryResult colliderPoint;
 	getClosestPoint(_surface, *position, &colliderPoint);
+	applyCollisionResponse(colliderPoint, radius, restitutionCoefficient, position, velocity);
+}
+
+void Collider::resolveCollisions(std::vector<Vector3>& positions, std::vector<Vector3>& velocities, double radius, double restitutionCoefficient)
+{
+	parallelRangeFor(0, positions.size(), [&](size_t begin, size_t end)
+	{
+		SurfaceQueryResult surfaceResults[kCollisionBatchSize];
+		for (size_t batchBegin = begin; batchBegin < end; batchBegin += kCollisionBatchSize)
+		{
+			const size_t count = std::min(kCollisionBatchSize, end - batchBegin);
+			_surface->closestQueries(&positions[batchBegin], count, surfaceResults);
 
+			for (size_t l = 0; l < count; ++l)
+			{
+				const size_t i = batchBegin + l;
+				ColliderQueryResult colliderPoint;
+				colliderPoint.distance = surfaceResults[l].distance;
+				colliderPoint.point = surfaceResults[l].point;
+				colliderPoint.normal = surfaceResults[l].normal;
+				colliderPoint.isInside = surfaceResults[l].isInside;
+				colliderPoint.velocity = velocityAt(positions[i]);
+				applyCollisionResponse(colliderPoint, radius, restitutionCoefficient, &positions[i], &velocities[i]);
+			}
+		}
+	});
+}
+
+void Collider::applyCollisionResponse(const ColliderQueryResult & colliderPoint, double radius, double restitutionCoefficient, Vector3 * position, Vector3 * velocity)
+{
 	// Check if the new position is penetrating the surface
 	if (isPenetrating(colliderPoint, *position, radius)) 
 	{
@@ -103,13 +139,15 @@ bool Collider::isPenetrating(const ColliderQueryResult & colliderPoint, Vector3
 	// If the new candidate position of the particle is inside
     // the volume defined by the surface OR the new distance to the surface is
     // less than the particle's radius, this particle is in colliding state.
-	return _surface->isInside(pos) || colliderPoint.distance < radius;
+	return colliderPoint.isInside || colliderPoint.distance < radius;
 }
 
 void Collider::getClosestPoint(SurfacePtr& surface, Vector3& queryPoint, ColliderQueryResult* result)
 {
-	result->distance = surface->closestDistance(queryPoint);
-	result->point = surface->closestPoint(queryPoint);
-	result->normal = surface->closestNormal(queryPoint);
+	SurfaceQueryResult surfaceResult = surface->closestQuery(queryPoint);
+	result->distance = surfaceResult.distance;
+	result->point = surfaceResult.point;
+	result->normal = surfaceResult.normal;
+	result->isInside = surfaceResult.isInside;
 	result->velocity = velocityAt(queryPoint);
 }
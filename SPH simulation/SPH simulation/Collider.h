@@ -4,6 +4,7 @@
 
 #include <functional>
 #include <memory>
+#include <vector>
 
 #include "Surface.h"
 #include "Vector3.h"
@@ -24,6 +25,19 @@ public:
 		Vector3* position,
 		Vector3* velocity);
 
+	//!
+	//! \brief Resolves collisions of all particles in \p positions.
+	//!
+	//! Runs in parallel chunks. Each chunk queries the surface in batches
+	//! through Surface::closestQueries() and then applies the same response
+	//! as resolveCollision().
+	//!
+	void resolveCollisions(
+		std::vector<Vector3>& positions,
+		std::vector<Vector3>& velocities,
+		double radius,
+		double restitutionCoefficient);
+
 	double frictionCoefficient() const;
 	void setFrictionCoefficient(double newVal);
 
@@ -39,6 +53,7 @@ protected:
 		Vector3 point;
 		Vector3 normal;
 		Vector3 velocity;
+		bool isInside;
 	};
 
 	void setSurface(SurfacePtr& newSurface);
@@ -53,6 +68,14 @@ protected:
 		Vector3& queryPoint,
 		ColliderQueryResult* result);
 
+	//! Moves a penetrating particle out and updates its velocity.
+	void applyCollisionResponse(
+		const ColliderQueryResult& colliderPoint,
+		double radius,
+		double restitutionCoefficient,
+		Vector3* position,
+		Vector3* velocity);
+
 private:
 	double _frictionCoeffient = 0.0;
 	OnBeginUpdateCallback _onUpdateCallback;
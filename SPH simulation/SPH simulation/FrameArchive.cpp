@@ -0,0 +1,393 @@
+#include "FrameArchive.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	bool hasMagic(const char* magic, const char* expected)
+	{
+		return std::memcmp(magic, expected, 4) == 0;
+	}
+}
+
+FrameArchiveWriter::FrameArchiveWriter()
+{
+}
+
+FrameArchiveWriter::~FrameArchiveWriter()
+{
+	if (isOpen())
+	{
+		close();
+	}
+}
+
+bool FrameArchiveWriter::open(const std::string & filename)
+{
+	if (isOpen())
+	{
+		close();
+	}
+
+	_file.open(filename, std::ios::binary | std::ios::trunc);
+	if (!_file)
+	{
+		return false;
+	}
+	_entries.clear();
+	_hasFailed = false;
+
+	FrameArchiveHeader header = {};
+	std::memcpy(header.magic, "SPHA", 4);
+	header.version = kFrameArchiveVersion;
+	header.alignment = kFrameArchiveAlignment;
+	_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	_size = sizeof(header);
+	return static_cast<bool>(_file);
+}
+
+bool FrameArchiveWriter::isOpen() const
+{
+	return _file.is_open();
+}
+
+bool FrameArchiveWriter::appendSnapshot(const FrameSnapshot & snapshot)
+{
+	if (!isOpen() || _hasFailed)
+	{
+		return false;
+	}
+
+	pad();
+	FrameArchiveEntry entry = {};
+	entry.frameIndex = snapshot.frameIndex;
+	entry.offset = _size;
+	entry.size = FrameWriter::snapshotSize(snapshot);
+
+	if (!FrameWriter::writeSnapshot(_file, snapshot))
+	{
+		// The file position is unknown now, later frames would be misplaced.
+		_hasFailed = true;
+		return false;
+	}
+	_size += entry.size;
+	_entries.push_back(entry);
+	return true;
+}
+
+bool FrameArchiveWriter::close()
+{
+	if (!isOpen())
+	{
+		return false;
+	}
+
+	if (!_hasFailed)
+	{
+		pad();
+		FrameArchiveFooter footer = {};
+		footer.indexOffset = _size;
+		footer.numberOfFrames = static_cast<uint32_t>(_entries.size());
+		footer.version = kFrameArchiveVersion;
+		std::memcpy(footer.magic, "SPHI", 4);
+
+		_file.write(reinterpret_cast<const char*>(_entries.data()),
+			_entries.size() * sizeof(FrameArchiveEntry));
+		_file.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+	}
+
+	const bool isWritten = !_hasFailed && static_cast<bool>(_file);
+	_file.close();
+	return isWritten && !_file.fail();
+}
+
+size_t FrameArchiveWriter::numberOfFrames() const
+{
+	return _entries.size();
+}
+
+void FrameArchiveWriter::pad()
+{
+	const char padding[kFrameArchiveAlignment] = {};
+	const uint64_t alignedSize = alignUp(_size, kFrameArchiveAlignment);
+	_file.write(padding, alignedSize - _size);
+	_size = alignedSize;
+}
+
+const float * FrameArchiveFrame::positions() const
+{
+	if (header == nullptr || header->positionEncoding != kPositionEncodingRaw)
+	{
+		return nullptr;
+	}
+	return reinterpret_cast<const float*>(positionData);
+}
+
+const float * FrameArchiveFrame::heights() const
+{
+	if (header == nullptr || header->heightEncoding != kHeightEncodingRaw)
+	{
+		return nullptr;
+	}
+	return reinterpret_cast<const float*>(heightData);
+}
+
+FrameArchiveReader::FrameArchiveReader()
+{
+}
+
+FrameArchiveReader::~FrameArchiveReader()
+{
+	close();
+}
+
+bool FrameArchiveReader::open(const std::string & filename)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	_file = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+	_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (_mapping == nullptr)
+	{
+		close();
+		return false;
+	}
+	_data = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+	_size = static_cast<size_t>(fileSize.QuadPart);
+#else
+	_file = ::open(filename.c_str(), O_RDONLY);
+	if (_file < 0)
+	{
+		return false;
+	}
+
+	struct stat status;
+	if (fstat(_file, &status) != 0 || status.st_size == 0)
+	{
+		close();
+		return false;
+	}
+	void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, _file, 0);
+	_data = (data == MAP_FAILED) ? nullptr : static_cast<const uint8_t*>(data);
+	_size = static_cast<size_t>(status.st_size);
+#endif
+	if (_data == nullptr)
+	{
+		close();
+		return false;
+	}
+
+	if (!readIndex() && !rebuildIndex())
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void FrameArchiveReader::close()
+{
+#ifdef _WIN32
+	if (_data != nullptr)
+	{
+		UnmapViewOfFile(_data);
+	}
+	if (_mapping != nullptr)
+	{
+		CloseHandle(_mapping);
+		_mapping = nullptr;
+	}
+	if (_file != nullptr)
+	{
+		CloseHandle(_file);
+		_file = nullptr;
+	}
+#else
+	if (_data != nullptr)
+	{
+		munmap(const_cast<uint8_t*>(_data), _size);
+	}
+	if (_file >= 0)
+	{
+		::close(_file);
+		_file = -1;
+	}
+#endif
+	_data = nullptr;
+	_size = 0;
+	_entries.clear();
+	_isRecovered = false;
+}
+
+bool FrameArchiveReader::isOpen() const
+{
+	return _data != nullptr;
+}
+
+bool FrameArchiveReader::isRecovered() const
+{
+	return _isRecovered;
+}
+
+size_t FrameArchiveReader::numberOfFrames() const
+{
+	return _entries.size();
+}
+
+const FrameArchiveEntry & FrameArchiveReader::entry(size_t i) const
+{
+	return _entries[i];
+}
+
+bool FrameArchiveReader::findFrame(uint32_t frameIndex, size_t * i) const
+{
+	// Frames are normally appended in frame order.
+	auto it = std::lower_bound(_entries.begin(), _entries.end(), frameIndex,
+		[](const FrameArchiveEntry& entry, uint32_t index) { return entry.frameIndex < index; });
+	if (it == _entries.end() || it->frameIndex != frameIndex)
+	{
+		it = std::find_if(_entries.begin(), _entries.end(),
+			[frameIndex](const FrameArchiveEntry& entry) { return entry.frameIndex == frameIndex; });
+	}
+	if (it == _entries.end())
+	{
+		return false;
+	}
+	*i = static_cast<size_t>(it - _entries.begin());
+	return true;
+}
+
+FrameArchiveFrame FrameArchiveReader::frame(size_t i) const
+{
+	const uint8_t* begin = _data + _entries[i].offset;
+	FrameArchiveFrame frame;
+	frame.header = reinterpret_cast<const FrameFileHeader*>(begin);
+	frame.positionData = begin + frame.header->positionsOffset;
+	frame.heightData = begin + frame.header->heightsOffset;
+	return frame;
+}
+
+const uint8_t * FrameArchiveReader::data() const
+{
+	return _data;
+}
+
+size_t FrameArchiveReader::size() const
+{
+	return _size;
+}
+
+bool FrameArchiveReader::readIndex()
+{
+	if (_size < sizeof(FrameArchiveHeader) + sizeof(FrameArchiveFooter))
+	{
+		return false;
+	}
+	const FrameArchiveHeader* header = reinterpret_cast<const FrameArchiveHeader*>(_data);
+	if (!hasMagic(header->magic, "SPHA") || header->version != kFrameArchiveVersion)
+	{
+		return false;
+	}
+
+	FrameArchiveFooter footer;
+	std::memcpy(&footer, _data + _size - sizeof(footer), sizeof(footer));
+	const uint64_t indexSize = static_cast<uint64_t>(footer.numberOfFrames) * sizeof(FrameArchiveEntry);
+	if (!hasMagic(footer.magic, "SPHI") || footer.version != kFrameArchiveVersion ||
+		footer.indexOffset > _size || footer.indexOffset + indexSize != _size - sizeof(footer))
+	{
+		return false;
+	}
+
+	_entries.resize(footer.numberOfFrames);
+	std::memcpy(_entries.data(), _data + footer.indexOffset, indexSize);
+	for (const auto& entry : _entries)
+	{
+		if (entry.offset + entry.size > footer.indexOffset || !isValidFrame(entry.offset, entry.size))
+		{
+			_entries.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FrameArchiveReader::rebuildIndex()
+{
+	// An archive whose writer did not close it has frames but no index.
+	if (_size < sizeof(FrameArchiveHeader) ||
+		!hasMagic(reinterpret_cast<const FrameArchiveHeader*>(_data)->magic, "SPHA"))
+	{
+		return false;
+	}
+
+	_entries.clear();
+	uint64_t offset = alignUp(sizeof(FrameArchiveHeader), kFrameArchiveAlignment);
+	while (offset + sizeof(FrameFileHeader) <= _size)
+	{
+		const FrameFileHeader* header = reinterpret_cast<const FrameFileHeader*>(_data + offset);
+		FrameArchiveEntry entry = {};
+		entry.frameIndex = header->frameIndex;
+		entry.offset = offset;
+		entry.size = std::min<uint64_t>(header->heightsOffset, _size) + header->heightsSize;
+		if (!isValidFrame(entry.offset, entry.size))
+		{
+			// A frame cut short by the end of the file.
+			break;
+		}
+		_entries.push_back(entry);
+		offset = alignUp(offset + entry.size, kFrameArchiveAlignment);
+	}
+	_isRecovered = true;
+	return true;
+}
+
+bool FrameArchiveReader::isValidFrame(uint64_t offset, uint64_t size) const
+{
+	if (offset % kFrameArchiveAlignment != 0 || size < sizeof(FrameFileHeader) ||
+		offset > _size || size > _size - offset)
+	{
+		return false;
+	}
+	const FrameFileHeader* header = reinterpret_cast<const FrameFileHeader*>(_data + offset);
+	return hasMagic(header->magic, "SPHF") && header->version == kFrameFileVersion &&
+		header->positionsOffset >= sizeof(FrameFileHeader) &&
+		header->heightsOffset <= size && header->positionsOffset <= header->heightsOffset &&
+		header->positionsSize <= header->heightsOffset - header->positionsOffset &&
+		header->heightsOffset % kFrameArrayAlignment == 0 &&
+		header->heightsSize <= size - header->heightsOffset;
+}
@@ -0,0 +1,193 @@
+#pragma once
+#ifndef INCLUDE_FRAME_ARCHIVE_H_
+#define INCLUDE_FRAME_ARCHIVE_H_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "FrameWriter.h"
+
+//!
+//! \brief Header at the start of a frame archive.
+//!
+//! An archive is a FrameArchiveHeader, then every frame as a frame file
+//! (see FrameFileHeader) starting at a multiple of kFrameArchiveAlignment,
+//! then the index as one FrameArchiveEntry per frame, then a
+//! FrameArchiveFooter that ends the file. Frames are appended as they
+//! arrive and the index is only written on close. An archive without a
+//! footer is still readable, its frames are found by walking the frame
+//! headers.
+//!
+struct FrameArchiveHeader
+{
+	//! "SPHA".
+	char magic[4];
+	uint32_t version;
+	uint32_t alignment;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(FrameArchiveHeader) == 16, "FrameArchiveHeader must not be padded");
+
+//! Index entry of one frame.
+struct FrameArchiveEntry
+{
+	uint32_t frameIndex;
+	uint32_t reserved;
+	//! Byte offset of the frame header from the start of the archive.
+	uint64_t offset;
+	uint64_t size;
+};
+
+static_assert(sizeof(FrameArchiveEntry) == 24, "FrameArchiveEntry must not be padded");
+
+//! Last bytes of a closed archive.
+struct FrameArchiveFooter
+{
+	uint64_t indexOffset;
+	uint32_t numberOfFrames;
+	uint32_t version;
+	//! "SPHI".
+	char magic[4];
+	uint32_t reserved;
+};
+
+static_assert(sizeof(FrameArchiveFooter) == 24, "FrameArchiveFooter must not be padded");
+
+//! Version written to FrameArchiveHeader::version and FrameArchiveFooter::version.
+const uint32_t kFrameArchiveVersion = 1;
+
+//! Alignment of every frame in an archive, one cache line.
+const uint32_t kFrameArchiveAlignment = 64;
+
+//!
+//! \brief Appends frames to a single archive file.
+//!
+//! Replaces one file per frame with one file per run, which is opened
+//! once and only ever appended to.
+//!
+class FrameArchiveWriter
+{
+public:
+	FrameArchiveWriter();
+
+	//! Closes the archive if it is still open.
+	~FrameArchiveWriter();
+
+	FrameArchiveWriter(const FrameArchiveWriter&) = delete;
+	FrameArchiveWriter& operator=(const FrameArchiveWriter&) = delete;
+
+	//! Creates \p filename, replacing any existing file. Returns false if
+	//! it could not be created.
+	bool open(const std::string& filename);
+
+	//! Returns true between a successful open() and close().
+	bool isOpen() const;
+
+	//! Appends \p snapshot. Returns false if the write failed.
+	bool appendSnapshot(const FrameSnapshot& snapshot);
+
+	//! Writes the index and footer and closes the file. Returns false if
+	//! any write failed.
+	bool close();
+
+	//! Returns the number of frames appended since open().
+	size_t numberOfFrames() const;
+
+private:
+	std::ofstream _file;
+	uint64_t _size = 0;
+	std::vector<FrameArchiveEntry> _entries;
+	bool _hasFailed = false;
+
+	//! Pads the file with zeros up to the next multiple of kFrameArchiveAlignment.
+	void pad();
+};
+
+//!
+//! \brief Frame inside a mapped archive.
+//!
+//! The pointers point into the mapping and stay valid until the reader is
+//! closed. Nothing is copied.
+//!
+struct FrameArchiveFrame
+{
+	const FrameFileHeader* header = nullptr;
+	const uint8_t* positionData = nullptr;
+	const uint8_t* heightData = nullptr;
+
+	//! Returns the x, y, z positions, or nullptr if they are not raw.
+	const float* positions() const;
+
+	//! Returns the row-major heights, or nullptr if they are not raw.
+	const float* heights() const;
+};
+
+//!
+//! \brief Memory-maps a frame archive for random access playback.
+//!
+class FrameArchiveReader
+{
+public:
+	FrameArchiveReader();
+
+	//! Unmaps the archive if it is still open.
+	~FrameArchiveReader();
+
+	FrameArchiveReader(const FrameArchiveReader&) = delete;
+	FrameArchiveReader& operator=(const FrameArchiveReader&) = delete;
+
+	//! Maps \p filename and reads its index. Returns false if the file
+	//! could not be mapped or is not an archive.
+	bool open(const std::string& filename);
+
+	//! Unmaps the archive.
+	void close();
+
+	//! Returns true between a successful open() and close().
+	bool isOpen() const;
+
+	//! Returns true if the archive had no footer and its index was rebuilt
+	//! from the frame headers.
+	bool isRecovered() const;
+
+	//! Returns the number of frames in the archive.
+	size_t numberOfFrames() const;
+
+	//! Returns the index entry of the \p i-th frame in the archive.
+	const FrameArchiveEntry& entry(size_t i) const;
+
+	//! Finds the frame with frame index \p frameIndex. Returns false if the
+	//! archive does not contain it.
+	bool findFrame(uint32_t frameIndex, size_t* i) const;
+
+	//! Returns the \p i-th frame in the archive.
+	FrameArchiveFrame frame(size_t i) const;
+
+	//! Returns the mapped archive.
+	const uint8_t* data() const;
+
+	//! Returns the size of the mapped archive in bytes.
+	size_t size() const;
+
+private:
+	const uint8_t* _data = nullptr;
+	size_t _size = 0;
+	std::vector<FrameArchiveEntry> _entries;
+	bool _isRecovered = false;
+
+#ifdef _WIN32
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#else
+	int _file = -1;
+#endif
+
+	bool readIndex();
+	bool rebuildIndex();
+	bool isValidFrame(uint64_t offset, uint64_t size) const;
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "FrameWriter.h"
+
+#include <cstring>
+#include <fstream>
+
+void FrameWriter::setOffset(const Vector3 & offset)
+{
+	_offset = offset;
+}
+
+const Vector3 & FrameWriter::offset() const
+{
+	return _offset;
+}
+
+void FrameWriter::makeSnapshot(
+	uint32_t frameIndex,
+	const std::vector<Vector3>& positions,
+	const std::vector<Vector3>& vertices,
+	size_t resolutionX,
+	size_t resolutionZ,
+	FrameSnapshot * snapshot) const
+{
+	snapshot->frameIndex = frameIndex;
+	snapshot->resolutionX = static_cast<uint32_t>(resolutionX);
+	snapshot->resolutionZ = static_cast<uint32_t>(resolutionZ);
+	convertPositions(positions, snapshot);
+
+	snapshot->heightEncoding = kHeightEncodingRaw;
+	snapshot->heightData.resize(vertices.size() * sizeof(float));
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		const float height = static_cast<float>(vertices[i].y + _offset.y);
+		std::memcpy(snapshot->heightData.data() + i * sizeof(float), &height, sizeof(float));
+	}
+}
+
+void FrameWriter::makeSnapshot(
+	uint32_t frameIndex,
+	const std::vector<Vector3>& positions,
+	Heightfield & heightfield,
+	FrameSnapshot * snapshot)
+{
+	snapshot->frameIndex = frameIndex;
+	snapshot->resolutionX = static_cast<uint32_t>(heightfield.resolutionX());
+	snapshot->resolutionZ = static_cast<uint32_t>(heightfield.resolutionZ());
+	if (_isUsingQuantisedPositions)
+	{
+		snapshot->numberOfParticles = static_cast<uint32_t>(positions.size());
+		snapshot->positionEncoding = _positionEncoder.encode(
+			frameIndex, positions, _offset, &snapshot->positionData);
+	}
+	else
+	{
+		convertPositions(positions, snapshot);
+	}
+
+	if (_isUsingHeightDeltas)
+	{
+		snapshot->heightEncoding = _heightEncoder.encode(
+			frameIndex, heightfield, _offset.y, &snapshot->heightData);
+		return;
+	}
+
+	const auto& heights = heightfield.heights();
+	snapshot->heightEncoding = kHeightEncodingRaw;
+	snapshot->heightData.resize(heights.size() * sizeof(float));
+	for (size_t i = 0; i < heights.size(); ++i)
+	{
+		const float height = static_cast<float>(heights[i] + _offset.y);
+		std::memcpy(snapshot->heightData.data() + i * sizeof(float), &height, sizeof(float));
+	}
+}
+
+bool FrameWriter::isUsingHeightDeltas() const
+{
+	return _isUsingHeightDeltas;
+}
+
+void FrameWriter::setIsUsingHeightDeltas(bool isUsingHeightDeltas)
+{
+	_isUsingHeightDeltas = isUsingHeightDeltas;
+	_heightEncoder.reset();
+}
+
+HeightfieldDeltaEncoder & FrameWriter::heightEncoder()
+{
+	return _heightEncoder;
+}
+
+bool FrameWriter::isUsingQuantisedPositions() const
+{
+	return _isUsingQuantisedPositions;
+}
+
+void FrameWriter::setIsUsingQuantisedPositions(bool isUsingQuantisedPositions)
+{
+	_isUsingQuantisedPositions = isUsingQuantisedPositions;
+	_positionEncoder.reset();
+}
+
+ParticlePositionEncoder & FrameWriter::positionEncoder()
+{
+	return _positionEncoder;
+}
+
+void FrameWriter::convertPositions(const std::vector<Vector3>& positions, FrameSnapshot * snapshot) const
+{
+	snapshot->numberOfParticles = static_cast<uint32_t>(positions.size());
+	snapshot->positionEncoding = kPositionEncodingRaw;
+	snapshot->positionData.resize(3 * positions.size() * sizeof(float));
+	for (size_t i = 0; i < positions.size(); ++i)
+	{
+		const float xyz[3] = {
+			static_cast<float>(positions[i].x + _offset.x),
+			static_cast<float>(positions[i].y + _offset.y),
+			static_cast<float>(positions[i].z + _offset.z) };
+		std::memcpy(snapshot->positionData.data() + i * sizeof(xyz), xyz, sizeof(xyz));
+	}
+}
+
+bool FrameWriter::writeSnapshot(const std::string & filename, const FrameSnapshot & snapshot) const
+{
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		return false;
+	}
+	return writeSnapshot(file, snapshot);
+}
+
+bool FrameWriter::writeSnapshot(std::ostream & stream, const FrameSnapshot & snapshot)
+{
+	const FrameFileHeader header = makeHeader(snapshot);
+	const char padding[kFrameArrayAlignment] = {};
+
+	stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	stream.write(reinterpret_cast<const char*>(snapshot.positionData.data()),
+		snapshot.positionData.size());
+	stream.write(padding, header.heightsOffset - header.positionsOffset - header.positionsSize);
+	stream.write(reinterpret_cast<const char*>(snapshot.heightData.data()),
+		snapshot.heightData.size());
+	return static_cast<bool>(stream);
+}
+
+uint64_t FrameWriter::snapshotSize(const FrameSnapshot & snapshot)
+{
+	const FrameFileHeader header = makeHeader(snapshot);
+	return header.heightsOffset + header.heightsSize;
+}
+
+FrameFileHeader FrameWriter::makeHeader(const FrameSnapshot & snapshot)
+{
+	FrameFileHeader header = {};
+	header.magic[0] = 'S';
+	header.magic[1] = 'P';
+	header.magic[2] = 'H';
+	header.magic[3] = 'F';
+	header.version = kFrameFileVersion;
+	header.frameIndex = snapshot.frameIndex;
+	header.numberOfParticles = snapshot.numberOfParticles;
+	header.resolutionX = snapshot.resolutionX;
+	header.resolutionZ = snapshot.resolutionZ;
+	header.positionsOffset = sizeof(FrameFileHeader);
+	// Keep the heights aligned after variable-length position data.
+	header.heightsOffset = (header.positionsOffset + snapshot.positionData.size() + kFrameArrayAlignment - 1) /
+		kFrameArrayAlignment * kFrameArrayAlignment;
+	header.heightEncoding = snapshot.heightEncoding;
+	header.heightsSize = static_cast<uint32_t>(snapshot.heightData.size());
+	header.positionEncoding = snapshot.positionEncoding;
+	header.positionsSize = static_cast<uint32_t>(snapshot.positionData.size());
+	return header;
+}
+
+bool FrameWriter::writeFrame(
+	const std::string & filename,
+	uint32_t frameIndex,
+	const std::vector<Vector3>& positions,
+	const std::vector<Vector3>& vertices,
+	size_t resolutionX,
+	size_t resolutionZ)
+{
+	makeSnapshot(frameIndex, positions, vertices, resolutionX, resolutionZ, &_snapshot);
+	return writeSnapshot(filename, _snapshot);
+}
@@ -0,0 +1,168 @@
+#pragma once
+#ifndef INCLUDE_FRAME_WRITER_H_
+#define INCLUDE_FRAME_WRITER_H_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Heightfield.h"
+#include "HeightfieldDeltaEncoder.h"
+#include "ParticlePositionCodec.h"
+#include "Vector3.h"
+
+//!
+//! \brief Header at the start of every binary frame file.
+//!
+//! All fields are little-endian. The particle positions follow as
+//! positionsSize bytes at positionsOffset, encoded as given by
+//! positionEncoding (see ParticlePositionCodec.h). The heightfield follows as heightsSize bytes at heightsOffset, encoded as
+//! given by heightEncoding (see HeightfieldDeltaEncoder.h). Vertex (x, z)
+//! of the heightfield sits at (x, height, z) before the export offset is
+//! applied.
+//!
+struct FrameFileHeader
+{
+	//! "SPHF".
+	char magic[4];
+	uint32_t version;
+	uint32_t frameIndex;
+	uint32_t numberOfParticles;
+	uint32_t resolutionX;
+	uint32_t resolutionZ;
+	//! Byte offsets from the start of this header, which is the start of
+	//! the file for frame files.
+	uint64_t positionsOffset;
+	uint64_t heightsOffset;
+	uint32_t heightEncoding;
+	uint32_t heightsSize;
+	uint32_t positionEncoding;
+	uint32_t positionsSize;
+};
+
+static_assert(sizeof(FrameFileHeader) == 56, "FrameFileHeader must not be padded");
+
+//! Version written to FrameFileHeader::version.
+const uint32_t kFrameFileVersion = 3;
+
+//! Alignment of FrameFileHeader::heightsOffset, so mapped heights can be
+//! read in place.
+const size_t kFrameArrayAlignment = 8;
+
+//!
+//! \brief One frame of export data in the binary file layout.
+//!
+//! Positions and heights are already encoded and shifted by the export
+//! offset, so writing them is one bulk write per array.
+//!
+struct FrameSnapshot
+{
+	uint32_t frameIndex = 0;
+	uint32_t numberOfParticles = 0;
+	uint32_t resolutionX = 0;
+	uint32_t resolutionZ = 0;
+	uint32_t positionEncoding = kPositionEncodingRaw;
+	std::vector<uint8_t> positionData;
+	uint32_t heightEncoding = kHeightEncodingRaw;
+	std::vector<uint8_t> heightData;
+};
+
+//!
+//! \brief Writes simulation frames as binary frame files.
+//!
+//! The writer keeps its conversion buffers between frames, so exporting
+//! every frame does not allocate once the particle count is stable.
+//!
+class FrameWriter
+{
+public:
+	//! Sets the offset added to every exported position and height.
+	void setOffset(const Vector3& offset);
+
+	//! Returns the offset added to every exported position and height.
+	const Vector3& offset() const;
+
+	//!
+	//! \brief Converts a frame into \p snapshot.
+	//!
+	//! \p vertices are heightfield vertices in row-major order, only their
+	//! heights are kept. Positions are always written raw.
+	//!
+	void makeSnapshot(
+		uint32_t frameIndex,
+		const std::vector<Vector3>& positions,
+		const std::vector<Vector3>& vertices,
+		size_t resolutionX,
+		size_t resolutionZ,
+		FrameSnapshot* snapshot) const;
+
+	//!
+	//! \brief Converts a frame into \p snapshot, with heights taken from
+	//! \p heightfield.
+	//!
+	//! With height deltas enabled the heights go through heightEncoder()
+	//! and the heightfield's dirty tiles are cleared. With quantised
+	//! positions enabled the positions go through positionEncoder() and
+	//! must be ordered by particle ID.
+	//!
+	void makeSnapshot(
+		uint32_t frameIndex,
+		const std::vector<Vector3>& positions,
+		Heightfield& heightfield,
+		FrameSnapshot* snapshot);
+
+	//! Returns true if heightfield frames are written as tile deltas.
+	bool isUsingHeightDeltas() const;
+
+	//! Enables keyframe plus tile delta output for heightfield frames.
+	void setIsUsingHeightDeltas(bool isUsingHeightDeltas);
+
+	//! Returns the encoder used for heightfield frames, to configure the
+	//! keyframe interval and height quantum.
+	HeightfieldDeltaEncoder& heightEncoder();
+
+	//! Returns true if positions are written quantised.
+	bool isUsingQuantisedPositions() const;
+
+	//! Enables quantised keyframe plus delta output for positions.
+	void setIsUsingQuantisedPositions(bool isUsingQuantisedPositions);
+
+	//! Returns the encoder used for quantised positions, to configure the
+	//! bounds, error bound and keyframe interval.
+	ParticlePositionEncoder& positionEncoder();
+
+	//! Writes \p snapshot to \p filename. Returns false if the file could
+	//! not be written.
+	bool writeSnapshot(const std::string& filename, const FrameSnapshot& snapshot) const;
+
+	//! Writes \p snapshot, header first, to \p stream. Returns false if
+	//! the stream failed.
+	static bool writeSnapshot(std::ostream& stream, const FrameSnapshot& snapshot);
+
+	//! Returns the number of bytes writeSnapshot() writes for \p snapshot.
+	static uint64_t snapshotSize(const FrameSnapshot& snapshot);
+
+	//! Converts and writes a frame with the writer's own snapshot buffer.
+	bool writeFrame(
+		const std::string& filename,
+		uint32_t frameIndex,
+		const std::vector<Vector3>& positions,
+		const std::vector<Vector3>& vertices,
+		size_t resolutionX,
+		size_t resolutionZ);
+
+private:
+	Vector3 _offset;
+	FrameSnapshot _snapshot;
+	bool _isUsingHeightDeltas = false;
+	HeightfieldDeltaEncoder _heightEncoder;
+	bool _isUsingQuantisedPositions = false;
+	ParticlePositionEncoder _positionEncoder;
+
+	static FrameFileHeader makeHeader(const FrameSnapshot& snapshot);
+
+	void convertPositions(const std::vector<Vector3>& positions, FrameSnapshot* snapshot) const;
+};
+
+#endif
@@ -2,36 +2,59 @@
 
 Heightfield::Heightfield(std::vector<Vector3> points, bool isNormalFlipped, size_t resolutionX, size_t resolutionZ, BoundingBox maxRegion)
 {
-	_points = points;
+	_heights.resize(points.size());
+	for (size_t i = 0; i < points.size(); ++i)
+	{
+		_heights[i] = points[i].y;
+	}
 	_isNormalFlipped = isNormalFlipped;
 	_resolution_x = resolutionX;
 	_resolution_z = resolutionZ;
 	_maxRegion = maxRegion;
+	buildErosionBrush();
+	resetDirtyTiles();
 }
 
-Vector3 Heightfield::closestPointLocal(Vector3 otherPoint) const
+Heightfield::Heightfield(std::vector<double> heights, bool isNormalFlipped, size_t resolutionX, size_t resolutionZ, BoundingBox maxRegion)
+{
+	_heights = std::move(heights);
+	_isNormalFlipped = isNormalFlipped;
+	_resolution_x = resolutionX;
+	_resolution_z = resolutionZ;
+	_maxRegion = maxRegion;
+	buildErosionBrush();
+	resetDirtyTiles();
+}
+
+void Heightfield::triangleAt(const Vector3 & point, size_t cellX, size_t cellZ, Vector3 & vertex1, Vector3 & vertex2, Vector3 & vertex3) const
 {
-	Vector3 vertex1 = _points[std::floor(otherPoint.z)*_resolution_x + std::floor(otherPoint.x)] + Vector3(1,0,0);
-	Vector3 vertex2;
-	Vector3 vertex3;
-	
-	double _relativeXPos = vertex1.x - otherPoint.x;
-	double _relativeZPos = otherPoint.z - vertex1.z;
+	// The diagonal runs from (x + 1, z) to (x, z + 1).
+	double _relativeXPos = cellX + 1 - point.x;
+	double _relativeZPos = point.z - cellZ;
 
 	if (_relativeXPos >= _relativeZPos)
 	{
-		vertex1 = _points[std::floor(otherPoint.z)*_resolution_x + std::floor(otherPoint.x)];
-		vertex2 = _points[(std::floor(otherPoint.z) + 1)*_resolution_x + std::floor(otherPoint.x)];
-		vertex3 = _points[std::floor(otherPoint.z)*_resolution_x + std::floor(otherPoint.x) + 1];
+		vertex1 = vertexAt(cellX, cellZ);
+		vertex2 = vertexAt(cellX, cellZ + 1);
+		vertex3 = vertexAt(cellX + 1, cellZ);
 	}
 	else
 	{
-		vertex1 = _points[std::floor(otherPoint.z)*_resolution_x + std::floor(otherPoint.x) + 1];
-		vertex2 = _points[(std::floor(otherPoint.z) + 1)*_resolution_x + std::floor(otherPoint.x)];
-		vertex3 = _points[(std::floor(otherPoint.z) + 1)*_resolution_x + std::floor(otherPoint.x) + 1];
+		vertex1 = vertexAt(cellX + 1, cellZ);
+		vertex2 = vertexAt(cellX, cellZ + 1);
+		vertex3 = vertexAt(cellX + 1, cellZ + 1);
 	}
+}
+
+Vector3 Heightfield::closestPointLocal(Vector3 otherPoint) const
+{
+	size_t cellX, cellZ;
+	cellAt(otherPoint, cellX, cellZ);
+
+	Vector3 vertex1, vertex2, vertex3;
+	triangleAt(otherPoint, cellX, cellZ, vertex1, vertex2, vertex3);
 
-	Vector3 normal = closestNormalLocal(otherPoint);
+	Vector3 normal = (vertex1 - vertex2).cross(vertex1 - vertex3).normalized();
 
 	double t = ((vertex1 - otherPoint).dot(normal))/((normal*-1).dot(normal));
 
@@ -52,40 +75,53 @@ BoundingBox Heightfield::boundingBoxLocal() const
 
 Vector3 Heightfield::closestNormalLocal(const Vector3 & otherPoint) const
 {
-	Vector3 point = otherPoint;
-	if (point.x > _resolution_x - 1)
-	{
-		point.x = _resolution_x;
-	}
-	if (point.z > _resolution_z - 1)
-	{
-		point.z = _resolution_z;
-	}
-	Vector3 vertex1 = _points[std::floor(point.z)*_resolution_x + std::floor(point.x)];
-	vertex1.x += 1;
-	Vector3 vertex2;
-	Vector3 vertex3;
-	double _relativeXPos = vertex1.x - point.x;
-	double _relativeZPos = point.z - vertex1.z;
+	size_t cellX, cellZ;
+	cellAt(otherPoint, cellX, cellZ);
 
-	if (_relativeXPos >= _relativeZPos)
-	{
-		vertex1 = _points[std::floor(point.z)*_resolution_x + std::floor(point.x)];
-		vertex2 = _points[(std::floor(point.z) + 1)*_resolution_x + std::floor(point.x)];
-		vertex3 = _points[std::floor(point.z)*_resolution_x + std::floor(point.x) + 1];
-	}
-	else
-	{
-		vertex1 = _points[std::floor(point.z)*_resolution_x + std::floor(point.x) + 1];
-		vertex2 = _points[(std::floor(point.z) + 1)*_resolution_x + std::floor(point.x)];
-		vertex3 = _points[(std::floor(point.z) + 1)*_resolution_x + std::floor(point.x) + 1];
-	}
+	Vector3 vertex1, vertex2, vertex3;
+	triangleAt(otherPoint, cellX, cellZ, vertex1, vertex2, vertex3);
 
 	Vector3 edge1 = vertex1 - vertex2;
 	Vector3 edge2 = vertex1 - vertex3;
 
 	return edge1.cross(edge2).normalized();
+}
+
+SurfaceQueryResult Heightfield::closestQueryAt(const Vector3 & otherPoint) const
+{
+	size_t cellX, cellZ;
+	cellAt(otherPoint, cellX, cellZ);
+
+	Vector3 vertex1, vertex2, vertex3;
+	triangleAt(otherPoint, cellX, cellZ, vertex1, vertex2, vertex3);
+
+	SurfaceQueryResult result;
+	result.normal = (vertex1 - vertex2).cross(vertex1 - vertex3).normalized();
+
+	double t = ((vertex1 - otherPoint).dot(result.normal))/((result.normal*-1).dot(result.normal));
+	result.point = otherPoint + (result.normal*-1) * t;
+	result.distance = result.point.distanceTo(otherPoint);
+	result.isInside = otherPoint.y < result.point.y;
+	return result;
+}
+
+SurfaceQueryResult Heightfield::closestQueryLocal(const Vector3 & otherPoint)
+{
+	return closestQueryAt(otherPoint);
+}
+
+void Heightfield::closestQueries(const Vector3 * points, size_t numberOfPoints, SurfaceQueryResult * results)
+{
+	if (!transform.isIdentity() || isNormalFlipped)
+	{
+		Surface::closestQueries(points, numberOfPoints, results);
+		return;
+	}
 
+	for (size_t i = 0; i < numberOfPoints; ++i)
+	{
+		results[i] = closestQueryAt(points[i]);
+	}
 }
 
 bool Heightfield::isInsideLocal(Vector3 otherPoint)
@@ -98,139 +134,246 @@ Heightfield::Builder Heightfield::builder()
 	return Builder();
 }
 
-void Heightfield::depositToNode(Vector3 pos, double amountToDeposit)
+template <typename AddHeight>
+void Heightfield::depositToNodeWith(const Vector3& pos, double amountToDeposit, const AddHeight& addHeight) const
 {
 	// Add the sediment to the four vertices of the current node 
 	// using bilinear interpolation
 	// Deposition is not distributed over a radius (like erosion) 
 	// so that it can fill small pits
-	Vector3& vertex1 = _points[std::floor(pos.z)*_resolution_x + std::floor(pos.x)];
-	Vector3& vertex2 = _points[std::floor(pos.z)*_resolution_x + std::floor(pos.x)+1];
-	Vector3& vertex3 = _points[(std::floor(pos.z)+1)*_resolution_x + std::floor(pos.x)];
-	Vector3& vertex4 = _points[(std::floor(pos.z) + 1)*_resolution_x + std::floor(pos.x)+1];
+	size_t x, z;
+	cellAt(pos, x, z);
+	const double fx = std::min(std::max(pos.x - x, 0.0), 1.0);
+	const double fz = std::min(std::max(pos.z - z, 0.0), 1.0);
 
-	vertex1.y += amountToDeposit * (1 - (pos.x - vertex1.x)) * (1 - (pos.z - vertex1.z));
-	vertex2.y += amountToDeposit * ((pos.x - vertex1.x)) * (1 - (pos.z - vertex1.z));
-	vertex3.y += amountToDeposit * (1 - (pos.x - vertex1.x)) * (pos.z - vertex1.z);
-	vertex4.y += amountToDeposit * ((pos.x - vertex1.x)) * (pos.z - vertex1.z);
+	addHeight(z*_resolution_x + x, amountToDeposit * (1 - fx) * (1 - fz));
+	addHeight(z*_resolution_x + x + 1, amountToDeposit * fx * (1 - fz));
+	addHeight((z + 1)*_resolution_x + x, amountToDeposit * (1 - fx) * fz);
+	addHeight((z + 1)*_resolution_x + x + 1, amountToDeposit * fx * fz);
 }
 
-double Heightfield::erodeNode(Vector3 pos, double amountToErode)
+template <typename AddHeight>
+double Heightfield::erodeNodeWith(const Vector3& pos, double amountToErode, const AddHeight& addHeight) const
 {
-	double erosionRadius = 2.0;
-	int nodeindex = std::floor(pos.z)*_resolution_x + std::floor(pos.x);
-	double sediment = 0;
+	// Split the brush over the four vertices of the current node using
+	// bilinear interpolation, as deposition does, so the brush is centred
+	// on the droplet rather than on the corner of its cell
+	size_t x, z;
+	cellAt(pos, x, z);
+	const double fx = std::min(std::max(pos.x - x, 0.0), 1.0);
+	const double fz = std::min(std::max(pos.z - z, 0.0), 1.0);
 
-	Vector3& vertex1 = _points[std::floor(pos.z)*_resolution_x + std::floor(pos.x)];
-	Vector3& vertex2 = _points[std::floor(pos.z)*_resolution_x + std::floor(pos.x) + 1];
-	Vector3& vertex3 = _points[(std::floor(pos.z) + 1)*_resolution_x + std::floor(pos.x)];
-	Vector3& vertex4 = _points[(std::floor(pos.z) + 1)*_resolution_x + std::floor(pos.x) + 1];
+	double sediment = 0;
+	sediment += applyErosionBrushWith(x, z, amountToErode * (1 - fx) * (1 - fz), addHeight);
+	sediment += applyErosionBrushWith(x + 1, z, amountToErode * fx * (1 - fz), addHeight);
+	sediment += applyErosionBrushWith(x, z + 1, amountToErode * (1 - fx) * fz, addHeight);
+	sediment += applyErosionBrushWith(x + 1, z + 1, amountToErode * fx * fz, addHeight);
+	return sediment;
+}
 
-	double _relativeXPos = pos.x - vertex1.x;
-	double _relativeZPos = pos.z - vertex1.z;
-	//the node the particle is in
-	if (pos.distanceTo(vertex1) <= erosionRadius)
+template <typename AddHeight>
+double Heightfield::applyErosionBrushWith(size_t x, size_t z, double amountToErode, const AddHeight& addHeight) const
+{
+	if (amountToErode == 0.0)
 	{
-		vertex1.y -= amountToErode * (1 - (pos.x - vertex1.x)) * (1 - (pos.z - vertex1.z));
-		sediment += amountToErode * (1 - (pos.x - vertex1.x)) * (1 - (pos.z - vertex1.z));
+		return 0;
 	}
-	if (pos.distanceTo(vertex2) <= erosionRadius)
+	const size_t numberOfBrushNodes = _erosionBrushWeights.size();
+	double sediment = 0;
+
+	// Away from the border the whole brush is inside the grid.
+	if (x >= _erosionBrushExtent && z >= _erosionBrushExtent &&
+		x + _erosionBrushExtent < _resolution_x && z + _erosionBrushExtent < _resolution_z)
 	{
-		vertex2.y -= amountToErode * (pos.x - vertex1.x) * (1 - (pos.z - vertex1.z));
-		sediment += amountToErode * (pos.x - vertex1.x) * (1 - (pos.z - vertex1.z));
+		const ptrdiff_t centre = static_cast<ptrdiff_t>(z*_resolution_x + x);
+		for (size_t k = 0; k < numberOfBrushNodes; ++k)
+		{
+			const double amount = amountToErode * _erosionBrushWeights[k];
+			addHeight(static_cast<size_t>(centre + _erosionBrushIndexOffsets[k]), -amount);
+			sediment += amount;
+		}
+		return sediment;
 	}
-	if (pos.distanceTo(vertex3) <= erosionRadius)
+
+	// Near the border the nodes outside the grid are dropped and the weights
+	// of the rest renormalised, so the brush still removes amountToErode.
+	auto isInGrid = [&](size_t k)
+	{
+		const ptrdiff_t nodeX = static_cast<ptrdiff_t>(x) + _erosionBrushOffsetsX[k];
+		const ptrdiff_t nodeZ = static_cast<ptrdiff_t>(z) + _erosionBrushOffsetsZ[k];
+		return nodeX >= 0 && nodeZ >= 0 &&
+			nodeX < static_cast<ptrdiff_t>(_resolution_x) && nodeZ < static_cast<ptrdiff_t>(_resolution_z);
+	};
+
+	double inGridWeightSum = 0;
+	for (size_t k = 0; k < numberOfBrushNodes; ++k)
 	{
-		vertex3.y -= amountToErode * (1 - (pos.x - vertex1.x)) * (pos.z - vertex1.z);
-		sediment += amountToErode * (1 - (pos.x - vertex1.x)) * (pos.z - vertex1.z);
+		if (isInGrid(k))
+		{
+			inGridWeightSum += _erosionBrushWeights[k];
+		}
 	}
-	if (pos.distanceTo(vertex4) <= erosionRadius)
+	if (inGridWeightSum <= 0.0)
 	{
-		vertex4.y -= amountToErode * (pos.x - vertex1.x) * (pos.z - vertex1.z);
-		sediment += amountToErode * (pos.x - vertex1.x) * (pos.z - vertex1.z);
+		return 0;
 	}
-	//the node to the west, if there is one
-	if (pos.x > 1)
+
+	const double scale = amountToErode / inGridWeightSum;
+	for (size_t k = 0; k < numberOfBrushNodes; ++k)
 	{
-		Vector3& vertex5 = _points[std::floor(pos.z)*_resolution_x + std::floor(pos.x) - 1];
-		if (pos.distanceTo(vertex5) <= erosionRadius)
+		if (!isInGrid(k))
 		{
-			vertex5.y -= amountToErode * (1 - (pos.x - vertex1.x)) * (1 - (pos.z - vertex1.z));
-			sediment += amountToErode * (1 - (pos.x - vertex1.x)) * (1 - (pos.z - vertex1.z));
-		}
-		if (pos.z < _resolution_z - 2)
-		{
-			Vector3& vertex6 = _points[(std::floor(pos.z) + 1)*_resolution_x + std::floor(pos.x) - 1];
-			if (pos.distanceTo(vertex6) <= erosionRadius)
-			{
-				vertex6.y -= amountToErode * (1 - (pos.x - vertex1.x)) * (pos.z - vertex1.z);
-				sediment += amountToErode * (1 - (pos.x - vertex1.x)) * (pos.z - vertex1.z);
-			}
+			continue;
 		}
+		const size_t nodeX = static_cast<size_t>(static_cast<ptrdiff_t>(x) + _erosionBrushOffsetsX[k]);
+		const size_t nodeZ = static_cast<size_t>(static_cast<ptrdiff_t>(z) + _erosionBrushOffsetsZ[k]);
+		const double amount = scale * _erosionBrushWeights[k];
+		addHeight(nodeZ*_resolution_x + nodeX, -amount);
+		sediment += amount;
 	}
-	//the node to the north, if there is one
-	if (pos.z < _resolution_z - 3)
+	return sediment;
+}
+
+void Heightfield::depositToNode(Vector3 pos, double amountToDeposit)
+{
+	depositToNodeWith(pos, amountToDeposit, [this](size_t node, double delta)
 	{
-		Vector3& vertex7 = _points[(std::floor(pos.z) + 2)*_resolution_x + std::floor(pos.x)];
-		if (pos.distanceTo(vertex7) <= erosionRadius)
-		{
-			vertex7.y -= amountToErode * (1 - (pos.x - vertex1.x)) * (pos.z - vertex1.z);
-			sediment += amountToErode * (1 - (pos.x - vertex1.x)) * (pos.z - vertex1.z);
-		}
-		if (pos.x < _resolution_x - 2)
-		{
-			Vector3& vertex8 = _points[(std::floor(pos.z) + 2)*_resolution_x + std::floor(pos.x) + 1];
-			if (pos.distanceTo(vertex8) <= erosionRadius)
-			{
-				vertex8.y -= amountToErode * (pos.x - vertex1.x) * (pos.z - vertex1.z);
-				sediment += amountToErode * (pos.x - vertex1.x) * (pos.z - vertex1.z);
-			}
-		}
+		addHeight(node, delta);
+	});
+}
+
+double Heightfield::erodeNode(Vector3 pos, double amountToErode)
+{
+	return erodeNodeWith(pos, amountToErode, [this](size_t node, double delta)
+	{
+		addHeight(node, delta);
+	});
+}
+
+void Heightfield::depositToNodeDeferred(const Vector3 & pos, double amountToDeposit, std::vector<HeightDelta>& deltas) const
+{
+	depositToNodeWith(pos, amountToDeposit, [&](size_t node, double delta)
+	{
+		deltas.push_back(HeightDelta{ node, delta });
+	});
+}
+
+double Heightfield::erodeNodeDeferred(const Vector3 & pos, double amountToErode, std::vector<HeightDelta>& deltas) const
+{
+	return erodeNodeWith(pos, amountToErode, [&](size_t node, double delta)
+	{
+		deltas.push_back(HeightDelta{ node, delta });
+	});
+}
+
+void Heightfield::applyHeightDeltas(const std::vector<HeightDelta>& deltas)
+{
+	for (const auto& change : deltas)
+	{
+		addHeight(change.node, change.delta);
 	}
-	//the node to the east, if there is one
-	if (pos.x < _resolution_x - 3)
+}
+
+size_t Heightfield::resolutionX() const
+{
+	return _resolution_x;
+}
+
+size_t Heightfield::resolutionZ() const
+{
+	return _resolution_z;
+}
+
+const std::vector<double>& Heightfield::heights() const
+{
+	return _heights;
+}
+
+size_t Heightfield::numberOfTilesX() const
+{
+	return _numberOfTilesX;
+}
+
+size_t Heightfield::numberOfTilesZ() const
+{
+	return _numberOfTilesZ;
+}
+
+const std::vector<uint8_t>& Heightfield::dirtyTiles() const
+{
+	return _dirtyTiles;
+}
+
+void Heightfield::clearDirtyTiles()
+{
+	std::fill(_dirtyTiles.begin(), _dirtyTiles.end(), static_cast<uint8_t>(0));
+}
+
+void Heightfield::resetDirtyTiles()
+{
+	_numberOfTilesX = (_resolution_x + kTileSize - 1) / kTileSize;
+	_numberOfTilesZ = (_resolution_z + kTileSize - 1) / kTileSize;
+	_dirtyTiles.assign(_numberOfTilesX * _numberOfTilesZ, 1);
+}
+
+double Heightfield::erosionRadius() const
+{
+	return _erosionRadius;
+}
+
+void Heightfield::setErosionRadius(double erosionRadius)
+{
+	_erosionRadius = erosionRadius;
+	buildErosionBrush();
+}
+
+void Heightfield::buildErosionBrush()
+{
+	_erosionBrushOffsetsX.clear();
+	_erosionBrushOffsetsZ.clear();
+	_erosionBrushIndexOffsets.clear();
+	_erosionBrushWeights.clear();
+
+	// A radius below one cell still erodes the vertex the brush is centred on.
+	const double radius = std::max(_erosionRadius, 1.0);
+	const int extent = static_cast<int>(std::ceil(radius));
+	double weightSum = 0.0;
+	for (int dz = -extent; dz <= extent; ++dz)
 	{
-		Vector3& vertex9 = _points[std::floor(pos.z)*_resolution_x + std::floor(pos.x) + 2];
-		if (pos.distanceTo(vertex9) <= erosionRadius)
+		for (int dx = -extent; dx <= extent; ++dx)
 		{
-			vertex9.y -= amountToErode * (pos.x - vertex1.x) * (1 - (pos.z - vertex1.z));
-			sediment += amountToErode * (pos.x - vertex1.x) * (1 - (pos.z - vertex1.z));
-		}
-		if (pos.z < _resolution_z - 2)
-		{
-			Vector3& vertex10 = _points[(std::floor(pos.z) + 1)*_resolution_x + std::floor(pos.x) + 2];
-			if (pos.distanceTo(vertex10) <= erosionRadius)
+			const double distance = std::sqrt(static_cast<double>(dx * dx + dz * dz));
+			if (distance >= radius)
 			{
-				vertex10.y -= amountToErode * (pos.x - vertex1.x) * (pos.z - vertex1.z);
-				sediment += amountToErode * (pos.x - vertex1.x) * (pos.z - vertex1.z);
+				continue;
 			}
+			const double weight = 1.0 - distance / radius;
+			_erosionBrushOffsetsX.push_back(dx);
+			_erosionBrushOffsetsZ.push_back(dz);
+			_erosionBrushIndexOffsets.push_back(
+				static_cast<ptrdiff_t>(dz) * static_cast<ptrdiff_t>(_resolution_x) + dx);
+			_erosionBrushWeights.push_back(weight);
+			weightSum += weight;
 		}
 	}
-	//the node to the south, if there is one
-	if (pos.z > 1)
+	for (double& weight : _erosionBrushWeights)
 	{
-		Vector3& vertex11 = _points[(std::floor(pos.z) - 1)*_resolution_x + std::floor(pos.x)];
-		if (pos.distanceTo(vertex11) <= erosionRadius)
-		{
-			vertex11.y -= amountToErode * (1 - (pos.x - vertex1.x)) * (1 - (pos.z - vertex1.z));
-			sediment += amountToErode * (1 - (pos.x - vertex1.x)) * (1 - (pos.z - vertex1.z));
-		}
-		if (pos.x < _resolution_x - 2)
-		{
-			Vector3& vertex12 = _points[(std::floor(pos.z) - 1)*_resolution_x + std::floor(pos.x) + 1];
-			if (pos.distanceTo(vertex12) <= erosionRadius)
-			{
-				vertex12.y -= amountToErode * (pos.x - vertex1.x) * (1 - (pos.z - vertex1.z));
-				sediment += amountToErode * (pos.x - vertex1.x) * (1 - (pos.z - vertex1.z));
-			}
-		}
+		weight /= weightSum;
 	}
-	return sediment;
+	_erosionBrushExtent = static_cast<size_t>(extent);
 }
 
 std::vector<Vector3> Heightfield::getVertices()
 {
-	return _points;
+	std::vector<Vector3> vertices(_heights.size());
+	for (size_t z = 0; z < _resolution_z; ++z)
+	{
+		for (size_t x = 0; x < _resolution_x; ++x)
+		{
+			vertices[z * _resolution_x + x] = vertexAt(x, z);
+		}
+	}
+	return vertices;
 }
 
 Heightfield::Builder & Heightfield::Builder::withIsNormalFlipped(bool isNormalFlipped)
@@ -241,7 +384,17 @@ Heightfield::Builder & Heightfield::Builder::withIsNormalFlipped(bool isNormalFl
 
 Heightfield::Builder & Heightfield::Builder::withPoints(const std::vector<Vector3>& points)
 {
-	_points = points;
+	_heights.resize(points.size());
+	for (size_t i = 0; i < points.size(); ++i)
+	{
+		_heights[i] = points[i].y;
+	}
+	return *this;
+}
+
+Heightfield::Builder & Heightfield::Builder::withHeights(const std::vector<double>& heights)
+{
+	_heights = heights;
 	return *this;
 }
 
@@ -252,16 +405,26 @@ Heightfield::Builder & Heightfield::Builder::withResolution(size_t resolutionX,
 	return *this;
 }
 
+Heightfield::Builder & Heightfield::Builder::withErosionRadius(double erosionRadius)
+{
+	_erosionRadius = erosionRadius;
+	return *this;
+}
+
 Heightfield Heightfield::Builder::build() const
 {
-	return Heightfield(_points, _isNormalFlipped, _resolution_x, _resolution_z, _maxRegion);
+	Heightfield heightfield(_heights, _isNormalFlipped, _resolution_x, _resolution_z, _maxRegion);
+	heightfield.setErosionRadius(_erosionRadius);
+	return heightfield;
 }
 
 HeightfieldPtr Heightfield::Builder::makeShared() const
 {
-	return std::shared_ptr<Heightfield>(
-		new Heightfield(_points, _isNormalFlipped, _resolution_x, _resolution_z, _maxRegion),
+	auto heightfield = std::shared_ptr<Heightfield>(
+		new Heightfield(_heights, _isNormalFlipped, _resolution_x, _resolution_z, _maxRegion),
 		[](Heightfield* obj) { delete obj; });
+	heightfield->setErosionRadius(_erosionRadius);
+	return heightfield;
 }
 
 Heightfield::Builder & Heightfield::Builder::withBox(BoundingBox maxRegion)
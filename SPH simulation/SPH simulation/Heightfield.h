@@ -2,6 +2,10 @@
 #ifndef INCLUDE_HEIGHTFIELD_H_
 #define INCLUDE_HEIGHTFIELD_H_
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 #include "Quaternion.h"
@@ -16,11 +20,68 @@ public:
 	class Builder;
 	Heightfield(std::vector<Vector3> points, bool isNormalFlipped, size_t resolutionX, size_t resolutionZ, BoundingBox maxRegion);
 
+	//! Constructs a heightfield from row-major heights, vertex (x, z) sits
+	//! at (x, heights[z * resolutionX + x], z).
+	Heightfield(std::vector<double> heights, bool isNormalFlipped, size_t resolutionX, size_t resolutionZ, BoundingBox maxRegion);
+
 	static Builder builder();
 
 	void depositToNode(Vector3 pos, double amountToDeposit) override;
 	double erodeNode(Vector3 pos, double amountToErode) override;
 
+	void depositToNodeDeferred(const Vector3& pos, double amountToDeposit, std::vector<HeightDelta>& deltas) const override;
+	double erodeNodeDeferred(const Vector3& pos, double amountToErode, std::vector<HeightDelta>& deltas) const override;
+	void applyHeightDeltas(const std::vector<HeightDelta>& deltas) override;
+
+	//! Batched closestQuery() without per-point virtual calls.
+	void closestQueries(const Vector3* points, size_t numberOfPoints, SurfaceQueryResult* results) override;
+
+	//! Returns the number of vertices along x.
+	size_t resolutionX() const;
+
+	//! Returns the number of vertices along z.
+	size_t resolutionZ() const;
+
+	//! Returns the row-major vertex heights.
+	const std::vector<double>& heights() const;
+
+	//! Vertices per side of a dirty tile.
+	static const size_t kTileSize = 16;
+
+	//! Returns the number of dirty tiles along x.
+	size_t numberOfTilesX() const;
+
+	//! Returns the number of dirty tiles along z.
+	size_t numberOfTilesZ() const;
+
+	//!
+	//! \brief Returns one flag per kTileSize x kTileSize tile, row-major.
+	//!
+	//! A tile is flagged once any of its heights changes through
+	//! erodeNode(), depositToNode() or applyHeightDeltas(). All tiles start
+	//! dirty. Exporters clear the flags with clearDirtyTiles().
+	//!
+	const std::vector<uint8_t>& dirtyTiles() const;
+
+	//! Clears every dirty tile flag.
+	void clearDirtyTiles();
+
+	//! Returns the radius, in grid cells, that erodeNode() spreads over.
+	double erosionRadius() const;
+
+	//!
+	//! \brief Sets the erosion radius and rebuilds the erosion brush.
+	//!
+	//! The brush holds the grid offsets within the radius and weights that
+	//! fall off linearly with distance and sum to one. An erosion event
+	//! applies it at the four vertices of the droplet's cell with bilinear
+	//! weights, so it removes exactly the requested amount, and costs four
+	//! multiply-adds per brush node. Near the border the weights of the
+	//! nodes inside the grid are renormalised to sum to one.
+	//!
+	void setErosionRadius(double erosionRadius);
+
+	//! Returns the grid vertices, synthesised from the heights.
 	std::vector<Vector3> getVertices() override;
 
 protected:
@@ -34,35 +95,119 @@ protected:
 
 	bool isInsideLocal(Vector3 otherPoint) override;
 
+	//! Looks the triangle up once for all four results.
+	SurfaceQueryResult closestQueryLocal(const Vector3& otherPoint) override;
+
 private:
+	//! Returns the vertex at grid coordinates (\p x, \p z).
+	Vector3 vertexAt(size_t x, size_t z) const;
+
+	//! Returns the cell containing \p point, clamped so that the cell and
+	//! its +x/+z neighbours are inside the grid.
+	void cellAt(const Vector3& point, size_t& cellX, size_t& cellZ) const;
+
+	//! Returns the triangle of cell (\p cellX, \p cellZ) above \p point.
+	void triangleAt(
+		const Vector3& point,
+		size_t cellX,
+		size_t cellZ,
+		Vector3& vertex1,
+		Vector3& vertex2,
+		Vector3& vertex3) const;
+
+	void buildErosionBrush();
+
+	//! Sizes the dirty tile flags for the resolution and marks all dirty.
+	void resetDirtyTiles();
+
+	//! Changes the height of \p node and flags its tile.
+	void addHeight(size_t node, double delta);
+
+	//! Body of closestQueryLocal(), inlined into the batched query.
+	SurfaceQueryResult closestQueryAt(const Vector3& otherPoint) const;
+
+	//! Shared by the immediate and deferred variants, \p addHeight(node, delta)
+	//! either changes the vertex or records the change.
+	template <typename AddHeight>
+	void depositToNodeWith(const Vector3& pos, double amountToDeposit, const AddHeight& addHeight) const;
+
+	template <typename AddHeight>
+	double erodeNodeWith(const Vector3& pos, double amountToErode, const AddHeight& addHeight) const;
+
+	//! Erodes \p amountToErode with the brush centred on vertex (\p x, \p z).
+	template <typename AddHeight>
+	double applyErosionBrushWith(size_t x, size_t z, double amountToErode, const AddHeight& addHeight) const;
 
 private:
-	std::vector<Vector3> _points;
+	//! Row-major vertex heights, x and z follow from the index.
+	std::vector<double> _heights;
 	bool _isNormalFlipped = false;
 	size_t _resolution_x;
 	size_t _resolution_z;
 	BoundingBox _maxRegion;
 
-	std::vector<std::vector<int>> erosionBrushIndices;
-	std::vector<std::vector<double>> erosionBrushWeights;
-	std::vector<int> secondArrayLength;
+	size_t _numberOfTilesX = 0;
+	size_t _numberOfTilesZ = 0;
+	std::vector<uint8_t> _dirtyTiles;
+
+	double _erosionRadius = 2.0;
+
+	//! Largest |offset| of the brush along x or z.
+	size_t _erosionBrushExtent = 0;
+
+	//! Brush node offsets from the vertex the brush is centred on, as grid
+	//! coordinates and as a row-major index for cells away from the border.
+	std::vector<int> _erosionBrushOffsetsX;
+	std::vector<int> _erosionBrushOffsetsZ;
+	std::vector<ptrdiff_t> _erosionBrushIndexOffsets;
+	std::vector<double> _erosionBrushWeights;
 };
 
 //! Shared pointer for the TriangleMesh3 type.
 typedef std::shared_ptr<Heightfield> HeightfieldPtr;
 
+inline Vector3 Heightfield::vertexAt(size_t x, size_t z) const
+{
+	return Vector3(
+		static_cast<double>(x),
+		_heights[z * _resolution_x + x],
+		static_cast<double>(z));
+}
+
+inline void Heightfield::cellAt(const Vector3& point, size_t& cellX, size_t& cellZ) const
+{
+	const double maxX = static_cast<double>(_resolution_x - 2);
+	const double maxZ = static_cast<double>(_resolution_z - 2);
+	cellX = static_cast<size_t>(std::min(std::max(std::floor(point.x), 0.0), maxX));
+	cellZ = static_cast<size_t>(std::min(std::max(std::floor(point.z), 0.0), maxZ));
+}
+
+inline void Heightfield::addHeight(size_t node, double delta)
+{
+	_heights[node] += delta;
+	const size_t z = node / _resolution_x;
+	const size_t x = node - z * _resolution_x;
+	_dirtyTiles[(z / kTileSize) * _numberOfTilesX + x / kTileSize] = 1;
+}
+
 class Heightfield::Builder
 {
 public:
 	//! Returns builder with flipped normal flag.
 	Builder& withIsNormalFlipped(bool isNormalFlipped);
 
-	//! Returns builder with points.
+	//! Returns builder with points, only their heights are kept.
 	Builder& withPoints(const std::vector<Vector3>& points);
 
+	//! Returns builder with row-major heights.
+	Builder& withHeights(const std::vector<double>& heights);
+
 	//! Returns builder with points.
 	Builder& withResolution(size_t resolutionX, size_t resolutionZ);
 
+	//! Returns builder with the erosion radius in grid cells.
+	Builder& withErosionRadius(double erosionRadius);
+
 	//! Builds TriangleMesh3.
 	Heightfield build() const;
 
@@ -73,9 +218,10 @@ public:
 
 private:
 	bool _isNormalFlipped = false;
-	std::vector<Vector3> _points;
+	std::vector<double> _heights;
 	size_t _resolution_x;
 	size_t _resolution_z;
+	double _erosionRadius = 2.0;
 	BoundingBox _maxRegion;
 };
 
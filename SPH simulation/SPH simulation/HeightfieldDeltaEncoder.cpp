@@ -0,0 +1,162 @@
+#include "HeightfieldDeltaEncoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+	template <typename T>
+	void append(std::vector<uint8_t>* data, const T& value)
+	{
+		const size_t offset = data->size();
+		data->resize(offset + sizeof(T));
+		std::memcpy(data->data() + offset, &value, sizeof(T));
+	}
+}
+
+void HeightfieldDeltaEncoder::setKeyframeInterval(size_t keyframeInterval)
+{
+	_keyframeInterval = std::max(keyframeInterval, static_cast<size_t>(1));
+}
+
+size_t HeightfieldDeltaEncoder::keyframeInterval() const
+{
+	return _keyframeInterval;
+}
+
+void HeightfieldDeltaEncoder::setHeightQuantum(double heightQuantum)
+{
+	_heightQuantum = heightQuantum;
+	reset();
+}
+
+double HeightfieldDeltaEncoder::heightQuantum() const
+{
+	return _heightQuantum;
+}
+
+void HeightfieldDeltaEncoder::reset()
+{
+	_hasKeyframe = false;
+}
+
+uint32_t HeightfieldDeltaEncoder::encode(
+	uint32_t frameIndex,
+	Heightfield & heightfield,
+	double heightOffset,
+	std::vector<uint8_t>* data)
+{
+	data->clear();
+
+	const size_t resolutionX = heightfield.resolutionX();
+	const size_t resolutionZ = heightfield.resolutionZ();
+	if (!_hasKeyframe || _framesSinceKeyframe + 1 >= _keyframeInterval ||
+		resolutionX != _resolutionX || resolutionZ != _resolutionZ)
+	{
+		encodeKeyframe(frameIndex, heightfield, heightOffset, data);
+		return kHeightEncodingRaw;
+	}
+
+	const size_t tileSize = Heightfield::kTileSize;
+	const size_t numberOfTilesX = heightfield.numberOfTilesX();
+	const auto& dirtyTiles = heightfield.dirtyTiles();
+	for (size_t t = 0; t < _changedTiles.size(); ++t)
+	{
+		_changedTiles[t] |= dirtyTiles[t];
+	}
+
+	// Quantise the changed tiles first, a delta out of range or a frame
+	// that is mostly dirty falls back to a keyframe.
+	const auto& heights = heightfield.heights();
+	const double inverseQuantum = 1.0 / _heightQuantum;
+	size_t numberOfChangedTiles = 0;
+	_deltas.clear();
+	for (size_t t = 0; t < _changedTiles.size(); ++t)
+	{
+		if (!_changedTiles[t])
+		{
+			continue;
+		}
+		++numberOfChangedTiles;
+
+		const size_t beginX = (t % numberOfTilesX) * tileSize;
+		const size_t beginZ = (t / numberOfTilesX) * tileSize;
+		const size_t endX = std::min(beginX + tileSize, resolutionX);
+		const size_t endZ = std::min(beginZ + tileSize, resolutionZ);
+		for (size_t z = beginZ; z < endZ; ++z)
+		{
+			for (size_t x = beginX; x < endX; ++x)
+			{
+				const size_t node = z * resolutionX + x;
+				const float height = static_cast<float>(heights[node] + heightOffset);
+				const double delta = std::round((height - _keyframeHeights[node]) * inverseQuantum);
+				if (delta < std::numeric_limits<int16_t>::min() ||
+					delta > std::numeric_limits<int16_t>::max())
+				{
+					encodeKeyframe(frameIndex, heightfield, heightOffset, data);
+					return kHeightEncodingRaw;
+				}
+				_deltas.push_back(static_cast<int16_t>(delta));
+			}
+		}
+	}
+
+	const size_t bitmapSize = (_changedTiles.size() + 7) / 8;
+	const size_t deltaFrameSize = 16 + bitmapSize + _deltas.size() * sizeof(int16_t);
+	if (deltaFrameSize >= heights.size() * sizeof(float))
+	{
+		encodeKeyframe(frameIndex, heightfield, heightOffset, data);
+		return kHeightEncodingRaw;
+	}
+
+	data->reserve(deltaFrameSize);
+	append(data, _keyframeIndex);
+	append(data, static_cast<uint32_t>(tileSize));
+	append(data, static_cast<float>(_heightQuantum));
+	append(data, static_cast<uint32_t>(numberOfChangedTiles));
+
+	const size_t bitmapOffset = data->size();
+	data->resize(bitmapOffset + bitmapSize, 0);
+	for (size_t t = 0; t < _changedTiles.size(); ++t)
+	{
+		if (_changedTiles[t])
+		{
+			(*data)[bitmapOffset + t / 8] |= static_cast<uint8_t>(1u << (t % 8));
+		}
+	}
+
+	const size_t deltasOffset = data->size();
+	data->resize(deltasOffset + _deltas.size() * sizeof(int16_t));
+	std::memcpy(data->data() + deltasOffset, _deltas.data(), _deltas.size() * sizeof(int16_t));
+
+	heightfield.clearDirtyTiles();
+	++_framesSinceKeyframe;
+	return kHeightEncodingTileDeltas;
+}
+
+void HeightfieldDeltaEncoder::encodeKeyframe(
+	uint32_t frameIndex,
+	Heightfield & heightfield,
+	double heightOffset,
+	std::vector<uint8_t>* data)
+{
+	const auto& heights = heightfield.heights();
+	_keyframeHeights.resize(heights.size());
+	for (size_t i = 0; i < heights.size(); ++i)
+	{
+		_keyframeHeights[i] = static_cast<float>(heights[i] + heightOffset);
+	}
+
+	data->resize(_keyframeHeights.size() * sizeof(float));
+	std::memcpy(data->data(), _keyframeHeights.data(), data->size());
+
+	_hasKeyframe = true;
+	_keyframeIndex = frameIndex;
+	_framesSinceKeyframe = 0;
+	_resolutionX = heightfield.resolutionX();
+	_resolutionZ = heightfield.resolutionZ();
+	_changedTiles.assign(heightfield.dirtyTiles().size(), 0);
+	heightfield.clearDirtyTiles();
+}
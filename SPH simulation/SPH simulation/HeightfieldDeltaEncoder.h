@@ -0,0 +1,95 @@
+#pragma once
+#ifndef INCLUDE_HEIGHTFIELD_DELTA_ENCODER_H_
+#define INCLUDE_HEIGHTFIELD_DELTA_ENCODER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "Heightfield.h"
+
+//! Heights stored as raw row-major float32, a keyframe.
+const uint32_t kHeightEncodingRaw = 0;
+
+//!
+//! Heights stored as changes against the last keyframe:
+//!   uint32 keyframe frame index
+//!   uint32 tile size in vertices
+//!   float32 height quantum
+//!   uint32 number of dirty tiles
+//!   uint8 bitmap, bit (t % 8) of byte (t / 8) set if row-major tile t changed
+//!   int16 quantised deltas for every vertex of each dirty tile, tiles in
+//!   row-major order and vertices row-major within the tile
+//! Tiles on the far edges are clipped to the grid. A height is the keyframe
+//! height plus quantum times its delta, or the keyframe height for vertices
+//! of clean tiles.
+//!
+const uint32_t kHeightEncodingTileDeltas = 1;
+
+//!
+//! \brief Encodes heightfield frames as keyframes and tile deltas.
+//!
+//! A delta frame only stores the tiles that changed since the last
+//! keyframe, using the heightfield's dirty tile flags. Deltas are against
+//! the keyframe rather than the previous frame, so any frame can be
+//! decoded from its keyframe alone and quantisation errors do not add up.
+//! A keyframe is written every keyframe interval, when the resolution
+//! changes, when a delta does not fit in 16 bits, or when the delta frame
+//! would not be smaller than a keyframe.
+//!
+class HeightfieldDeltaEncoder
+{
+public:
+	//! Sets the number of frames from one keyframe to the next.
+	void setKeyframeInterval(size_t keyframeInterval);
+
+	//! Returns the number of frames from one keyframe to the next.
+	size_t keyframeInterval() const;
+
+	//! Sets the height step of the quantised deltas.
+	void setHeightQuantum(double heightQuantum);
+
+	//! Returns the height step of the quantised deltas.
+	double heightQuantum() const;
+
+	//! Forces the next frame to be a keyframe.
+	void reset();
+
+	//!
+	//! \brief Encodes the heights of \p heightfield plus \p heightOffset.
+	//!
+	//! Writes the payload to \p data and returns kHeightEncodingRaw or
+	//! kHeightEncodingTileDeltas. Clears the heightfield's dirty tiles.
+	//!
+	uint32_t encode(
+		uint32_t frameIndex,
+		Heightfield& heightfield,
+		double heightOffset,
+		std::vector<uint8_t>* data);
+
+private:
+	size_t _keyframeInterval = 30;
+	double _heightQuantum = 1.0 / 4096.0;
+
+	bool _hasKeyframe = false;
+	uint32_t _keyframeIndex = 0;
+	size_t _framesSinceKeyframe = 0;
+	size_t _resolutionX = 0;
+	size_t _resolutionZ = 0;
+
+	//! Exported heights of the keyframe.
+	std::vector<float> _keyframeHeights;
+
+	//! Tiles changed since the keyframe.
+	std::vector<uint8_t> _changedTiles;
+
+	//! Scratch for the quantised deltas of the current frame.
+	std::vector<int16_t> _deltas;
+
+	void encodeKeyframe(
+		uint32_t frameIndex,
+		Heightfield& heightfield,
+		double heightOffset,
+		std::vector<uint8_t>* data);
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "Parallel.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+	//! Chunks handed out per thread, so uneven chunks still balance out.
+	const size_t kChunksPerThread = 4;
+
+	//! Ranges smaller than this are not worth waking the pool for.
+	const size_t kMinChunkSize = 64;
+
+	//! Set while a thread is executing a chunk, nested calls then run serially.
+	thread_local bool tIsInsideParallelRegion = false;
+
+	class ThreadPool
+	{
+	public:
+		explicit ThreadPool(unsigned int numberOfThreads)
+		{
+			for (unsigned int i = 1; i < numberOfThreads; ++i)
+			{
+				_workers.emplace_back([this]() { workerLoop(); });
+			}
+		}
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_isStopping = true;
+			}
+			_wakeUp.notify_all();
+			for (auto& worker : _workers)
+			{
+				worker.join();
+			}
+		}
+
+		void run(size_t numberOfChunks, const std::function<void(size_t)>& func)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_func = &func;
+			_numberOfChunks = numberOfChunks;
+			_nextChunk = 0;
+			_pendingChunks = numberOfChunks;
+			++_generation;
+			_wakeUp.notify_all();
+
+			// The calling thread takes chunks as well.
+			work(lock);
+
+			_finished.wait(lock, [this]() { return _pendingChunks == 0; });
+			_func = nullptr;
+		}
+
+	private:
+		std::vector<std::thread> _workers;
+		std::mutex _mutex;
+		std::condition_variable _wakeUp;
+		std::condition_variable _finished;
+
+		const std::function<void(size_t)>* _func = nullptr;
+		size_t _numberOfChunks = 0;
+		size_t _nextChunk = 0;
+		size_t _pendingChunks = 0;
+		size_t _generation = 0;
+		bool _isStopping = false;
+
+		void workerLoop()
+		{
+			size_t seenGeneration = 0;
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (true)
+			{
+				_wakeUp.wait(lock, [&]()
+				{
+					return _isStopping || _generation != seenGeneration;
+				});
+				if (_isStopping)
+				{
+					return;
+				}
+				seenGeneration = _generation;
+				work(lock);
+			}
+		}
+
+		//! Takes chunks until none are left. Called with \p lock held.
+		void work(std::unique_lock<std::mutex>& lock)
+		{
+			while (_func != nullptr && _nextChunk < _numberOfChunks)
+			{
+				size_t chunk = _nextChunk++;
+				const std::function<void(size_t)>& func = *_func;
+
+				lock.unlock();
+				tIsInsideParallelRegion = true;
+				func(chunk);
+				tIsInsideParallelRegion = false;
+				lock.lock();
+
+				if (--_pendingChunks == 0)
+				{
+					_finished.notify_all();
+				}
+			}
+		}
+	};
+
+	unsigned int sMaxNumberOfThreads = 0;
+	std::unique_ptr<ThreadPool> sThreadPool;
+	std::mutex sPoolMutex;
+}
+
+void setMaxNumberOfThreads(unsigned int numberOfThreads)
+{
+	std::lock_guard<std::mutex> lock(sPoolMutex);
+	sMaxNumberOfThreads = numberOfThreads;
+	sThreadPool.reset();
+}
+
+unsigned int maxNumberOfThreads()
+{
+	if (sMaxNumberOfThreads > 0)
+	{
+		return sMaxNumberOfThreads;
+	}
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+size_t parallelChunkCount(size_t beginIndex, size_t endIndex)
+{
+	if (beginIndex >= endIndex)
+	{
+		return 0;
+	}
+	const size_t n = endIndex - beginIndex;
+	const size_t numberOfThreads = maxNumberOfThreads();
+	if (numberOfThreads <= 1)
+	{
+		return 1;
+	}
+	return std::max(
+		std::min(numberOfThreads * kChunksPerThread, n / kMinChunkSize),
+		static_cast<size_t>(1));
+}
+
+void parallelForEachChunk(
+	size_t numberOfChunks,
+	const std::function<void(size_t)>& func)
+{
+	if (numberOfChunks == 1 || tIsInsideParallelRegion || maxNumberOfThreads() <= 1)
+	{
+		for (size_t chunk = 0; chunk < numberOfChunks; ++chunk)
+		{
+			func(chunk);
+		}
+		return;
+	}
+
+	// One parallel region at a time, the pool only tracks a single job.
+	std::lock_guard<std::mutex> lock(sPoolMutex);
+	if (!sThreadPool)
+	{
+		sThreadPool.reset(new ThreadPool(maxNumberOfThreads()));
+	}
+	sThreadPool->run(numberOfChunks, func);
+}
@@ -0,0 +1,93 @@
+#pragma once
+#ifndef INCLUDE_PARALLEL_H_
+#define INCLUDE_PARALLEL_H_
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+//!
+//! \brief Sets the number of threads used by the parallel helpers.
+//!
+//! Zero selects the hardware concurrency. The worker pool is rebuilt on the
+//! next parallel call. One thread makes every helper run serially.
+//!
+void setMaxNumberOfThreads(unsigned int numberOfThreads);
+
+//! Returns the number of threads used by the parallel helpers.
+unsigned int maxNumberOfThreads();
+
+//!
+//! \brief Returns the number of chunks [beginIndex, endIndex) is split into.
+//!
+//! The split only depends on the range and the thread count, so per-chunk
+//! results can be combined in chunk order for deterministic reductions.
+//!
+size_t parallelChunkCount(size_t beginIndex, size_t endIndex);
+
+//! Runs \p func(chunkIndex) for every chunk on the worker pool and blocks
+//! until all chunks are finished.
+void parallelForEachChunk(
+	size_t numberOfChunks,
+	const std::function<void(size_t)>& func);
+
+//!
+//! \brief Splits [beginIndex, endIndex) into chunks and runs them in parallel.
+//!
+//! \p func is called as func(chunkIndex, chunkBegin, chunkEnd).
+//!
+template <typename Function>
+void parallelChunkFor(size_t beginIndex, size_t endIndex, const Function& func)
+{
+	if (beginIndex >= endIndex)
+	{
+		return;
+	}
+
+	const size_t numberOfChunks = parallelChunkCount(beginIndex, endIndex);
+	if (numberOfChunks <= 1)
+	{
+		func(static_cast<size_t>(0), beginIndex, endIndex);
+		return;
+	}
+
+	const size_t n = endIndex - beginIndex;
+	const size_t chunkSize = (n + numberOfChunks - 1) / numberOfChunks;
+
+	parallelForEachChunk(numberOfChunks, [&](size_t chunk)
+	{
+		size_t chunkBegin = beginIndex + chunk * chunkSize;
+		size_t chunkEnd = std::min(chunkBegin + chunkSize, endIndex);
+		if (chunkBegin < chunkEnd)
+		{
+			func(chunk, chunkBegin, chunkEnd);
+		}
+	});
+}
+
+//! Runs \p func(chunkBegin, chunkEnd) over [beginIndex, endIndex) in parallel.
+template <typename Function>
+void parallelRangeFor(size_t beginIndex, size_t endIndex, const Function& func)
+{
+	parallelChunkFor(beginIndex, endIndex,
+		[&](size_t, size_t chunkBegin, size_t chunkEnd)
+	{
+		func(chunkBegin, chunkEnd);
+	});
+}
+
+//! Runs \p func(i) for every i in [beginIndex, endIndex) in parallel.
+template <typename Function>
+void parallelFor(size_t beginIndex, size_t endIndex, const Function& func)
+{
+	parallelChunkFor(beginIndex, endIndex,
+		[&](size_t, size_t chunkBegin, size_t chunkEnd)
+	{
+		for (size_t i = chunkBegin; i < chunkEnd; ++i)
+		{
+			func(i);
+		}
+	});
+}
+
+#endif
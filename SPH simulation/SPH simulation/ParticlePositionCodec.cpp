@@ -0,0 +1,431 @@
+#include "ParticlePositionCodec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+	//! Largest quantised value of an axis.
+	const double kMaxQuantisedValue = 65535.0;
+
+	template <typename T>
+	void append(std::vector<uint8_t>* data, const T& value)
+	{
+		const size_t offset = data->size();
+		data->resize(offset + sizeof(T));
+		std::memcpy(data->data() + offset, &value, sizeof(T));
+	}
+
+	template <typename T>
+	T readAt(const uint8_t* data, size_t offset)
+	{
+		T value;
+		std::memcpy(&value, data + offset, sizeof(T));
+		return value;
+	}
+
+	//! Maps small signed values to small unsigned values, 0, -1, 1, -2, ...
+	uint32_t zigzag(int32_t value)
+	{
+		return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+	}
+
+	int32_t unzigzag(uint32_t value)
+	{
+		return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+	}
+
+	//! Longest unary prefix of a Rice code before the value is escaped.
+	const uint32_t kMaxRiceQuotient = 32;
+
+	//! Bits of an escaped value, enough for any zigzag mapped 16-bit change.
+	const unsigned int kEscapeBits = 17;
+
+	//! Returns the size in bits of \p value as a Rice code with parameter \p k.
+	size_t riceCodeSize(uint32_t value, unsigned int k)
+	{
+		const uint32_t quotient = value >> k;
+		return (quotient < kMaxRiceQuotient) ? quotient + 1 + k : kMaxRiceQuotient + kEscapeBits;
+	}
+
+	//! Appends bits least significant first.
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(std::vector<uint8_t>* data) : _data(data) {}
+
+		~BitWriter() { flush(); }
+
+		void write(uint32_t bits, unsigned int count)
+		{
+			_buffer |= static_cast<uint64_t>(bits) << _count;
+			_count += count;
+			while (_count >= 8)
+			{
+				_data->push_back(static_cast<uint8_t>(_buffer));
+				_buffer >>= 8;
+				_count -= 8;
+			}
+		}
+
+		void writeRice(uint32_t value, unsigned int k)
+		{
+			const uint32_t quotient = value >> k;
+			if (quotient >= kMaxRiceQuotient)
+			{
+				write(0xffffffffu, kMaxRiceQuotient);
+				write(value, kEscapeBits);
+				return;
+			}
+			// quotient ones, a zero, then the k low bits.
+			write((1u << quotient) - 1, quotient + 1);
+			write(value & ((1u << k) - 1), k);
+		}
+
+		void flush()
+		{
+			if (_count > 0)
+			{
+				_data->push_back(static_cast<uint8_t>(_buffer));
+				_buffer = 0;
+				_count = 0;
+			}
+		}
+
+	private:
+		std::vector<uint8_t>* _data;
+		uint64_t _buffer = 0;
+		unsigned int _count = 0;
+	};
+
+	//! Reads bits written by BitWriter.
+	class BitReader
+	{
+	public:
+		BitReader(const uint8_t* data, size_t size) : _data(data), _size(size) {}
+
+		//! Returns false if the data ran out.
+		bool read(unsigned int count, uint32_t* bits)
+		{
+			while (_count < count)
+			{
+				if (_offset == _size)
+				{
+					return false;
+				}
+				_buffer |= static_cast<uint64_t>(_data[_offset++]) << _count;
+				_count += 8;
+			}
+			*bits = static_cast<uint32_t>(_buffer & ((static_cast<uint64_t>(1) << count) - 1));
+			_buffer >>= count;
+			_count -= count;
+			return true;
+		}
+
+		bool readRice(unsigned int k, uint32_t* value)
+		{
+			uint32_t quotient = 0;
+			uint32_t bit;
+			while (true)
+			{
+				if (!read(1, &bit))
+				{
+					return false;
+				}
+				if (bit == 0)
+				{
+					break;
+				}
+				if (++quotient == kMaxRiceQuotient)
+				{
+					return read(kEscapeBits, value);
+				}
+			}
+			uint32_t remainder = 0;
+			if (!read(k, &remainder))
+			{
+				return false;
+			}
+			*value = (quotient << k) | remainder;
+			return true;
+		}
+
+		//! Returns true if everything but the padding of the last byte was read.
+		bool isAtEnd() const { return _offset == _size && _count < 8; }
+
+	private:
+		const uint8_t* _data;
+		size_t _size;
+		size_t _offset = 0;
+		uint64_t _buffer = 0;
+		unsigned int _count = 0;
+	};
+}
+
+bool QuantisedPositionsInfo::read(const uint8_t * data, size_t size)
+{
+	if (size < kQuantisedPositionsHeaderSize)
+	{
+		return false;
+	}
+	frameIndex = readAt<uint32_t>(data, 0);
+	keyframeIndex = readAt<uint32_t>(data, 4);
+	referenceFrameIndex = readAt<uint32_t>(data, 8);
+	numberOfParticles = readAt<uint32_t>(data, 12);
+	for (size_t axis = 0; axis < 3; ++axis)
+	{
+		origin[axis] = readAt<float>(data, 16 + 4 * axis);
+		step[axis] = readAt<float>(data, 28 + 4 * axis);
+	}
+	return true;
+}
+
+void ParticlePositionEncoder::setBounds(const BoundingBox & bounds)
+{
+	_bounds = bounds;
+	reset();
+}
+
+const BoundingBox & ParticlePositionEncoder::bounds() const
+{
+	return _bounds;
+}
+
+void ParticlePositionEncoder::setErrorBound(double errorBound)
+{
+	_errorBound = std::max(errorBound, 0.0);
+	reset();
+}
+
+double ParticlePositionEncoder::errorBound() const
+{
+	return _errorBound;
+}
+
+void ParticlePositionEncoder::setKeyframeInterval(size_t keyframeInterval)
+{
+	_keyframeInterval = std::max(keyframeInterval, static_cast<size_t>(1));
+}
+
+size_t ParticlePositionEncoder::keyframeInterval() const
+{
+	return _keyframeInterval;
+}
+
+Vector3 ParticlePositionEncoder::step() const
+{
+	// The decoder works in float, so the step is rounded the same way.
+	const double minimumStep = 2.0 * _errorBound;
+	return Vector3(
+		static_cast<float>(std::max(minimumStep, _bounds.width() / kMaxQuantisedValue)),
+		static_cast<float>(std::max(minimumStep, _bounds.height() / kMaxQuantisedValue)),
+		static_cast<float>(std::max(minimumStep, _bounds.depth() / kMaxQuantisedValue)));
+}
+
+void ParticlePositionEncoder::reset()
+{
+	_hasFrame = false;
+}
+
+uint32_t ParticlePositionEncoder::encode(
+	uint32_t frameIndex,
+	const std::vector<Vector3>& positions,
+	const Vector3 & offset,
+	std::vector<uint8_t>* data)
+{
+	const Vector3 step = this->step();
+	const Vector3 origin(
+		static_cast<float>(_bounds.lowerCorner.x + offset.x),
+		static_cast<float>(_bounds.lowerCorner.y + offset.y),
+		static_cast<float>(_bounds.lowerCorner.z + offset.z));
+
+	_current.resize(3 * positions.size());
+	for (size_t i = 0; i < positions.size(); ++i)
+	{
+		const Vector3 p = positions[i] + offset;
+		_current[3 * i] = static_cast<uint16_t>(std::min(std::max(
+			std::round((p.x - origin.x) / step.x), 0.0), kMaxQuantisedValue));
+		_current[3 * i + 1] = static_cast<uint16_t>(std::min(std::max(
+			std::round((p.y - origin.y) / step.y), 0.0), kMaxQuantisedValue));
+		_current[3 * i + 2] = static_cast<uint16_t>(std::min(std::max(
+			std::round((p.z - origin.z) / step.z), 0.0), kMaxQuantisedValue));
+	}
+
+	bool isKeyframe = !_hasFrame || _framesSinceKeyframe + 1 >= _keyframeInterval ||
+		_previous.size() != _current.size();
+	const size_t keyframeSize = kQuantisedPositionsHeaderSize + _current.size() * sizeof(uint16_t);
+	if (!isKeyframe)
+	{
+		_changes.resize(_current.size());
+		for (size_t i = 0; i < _current.size(); ++i)
+		{
+			_changes[i] = zigzag(static_cast<int32_t>(_current[i]) - static_cast<int32_t>(_previous[i]));
+		}
+
+		// Pick the Rice parameter with the smallest code for each axis.
+		uint8_t riceParameters[4] = {};
+		for (size_t axis = 0; axis < 3; ++axis)
+		{
+			size_t bestSize = SIZE_MAX;
+			for (unsigned int k = 0; k <= kEscapeBits; ++k)
+			{
+				size_t size = 0;
+				for (size_t i = axis; i < _changes.size(); i += 3)
+				{
+					size += riceCodeSize(_changes[i], k);
+				}
+				if (size < bestSize)
+				{
+					bestSize = size;
+					riceParameters[axis] = static_cast<uint8_t>(k);
+				}
+			}
+		}
+
+		writeHeader(frameIndex, _keyframeIndex, _previousFrameIndex, positions.size(), origin, step, data);
+		data->insert(data->end(), riceParameters, riceParameters + 4);
+		{
+			BitWriter writer(data);
+			for (size_t i = 0; i < _changes.size(); ++i)
+			{
+				writer.writeRice(_changes[i], riceParameters[i % 3]);
+			}
+		}
+
+		// Large motions make the changes bigger than the values themselves,
+		// then a keyframe is smaller.
+		isKeyframe = data->size() >= keyframeSize;
+	}
+
+	if (isKeyframe)
+	{
+		writeHeader(frameIndex, frameIndex, frameIndex, positions.size(), origin, step, data);
+		data->resize(keyframeSize);
+		std::memcpy(data->data() + kQuantisedPositionsHeaderSize, _current.data(),
+			_current.size() * sizeof(uint16_t));
+		_keyframeIndex = frameIndex;
+		_framesSinceKeyframe = 0;
+	}
+	else
+	{
+		++_framesSinceKeyframe;
+	}
+
+	_current.swap(_previous);
+	_previousFrameIndex = frameIndex;
+	_hasFrame = true;
+	return kPositionEncodingQuantised;
+}
+
+void ParticlePositionEncoder::writeHeader(
+	uint32_t frameIndex,
+	uint32_t keyframeIndex,
+	uint32_t referenceFrameIndex,
+	size_t numberOfParticles,
+	const Vector3 & origin,
+	const Vector3 & step,
+	std::vector<uint8_t>* data) const
+{
+	data->clear();
+	append(data, frameIndex);
+	append(data, keyframeIndex);
+	append(data, referenceFrameIndex);
+	append(data, static_cast<uint32_t>(numberOfParticles));
+	append(data, static_cast<float>(origin.x));
+	append(data, static_cast<float>(origin.y));
+	append(data, static_cast<float>(origin.z));
+	append(data, static_cast<float>(step.x));
+	append(data, static_cast<float>(step.y));
+	append(data, static_cast<float>(step.z));
+}
+
+void ParticlePositionDecoder::reset()
+{
+	_hasFrame = false;
+}
+
+bool ParticlePositionDecoder::hasFrame() const
+{
+	return _hasFrame;
+}
+
+uint32_t ParticlePositionDecoder::frameIndex() const
+{
+	return _frameIndex;
+}
+
+bool ParticlePositionDecoder::canDecode(const uint8_t * data, size_t size) const
+{
+	QuantisedPositionsInfo info;
+	if (!info.read(data, size))
+	{
+		return false;
+	}
+	return info.isKeyframe() || (_hasFrame && info.referenceFrameIndex == _frameIndex &&
+		3 * static_cast<size_t>(info.numberOfParticles) == _values.size());
+}
+
+bool ParticlePositionDecoder::decode(const uint8_t * data, size_t size, std::vector<Vector3>* positions)
+{
+	QuantisedPositionsInfo info;
+	if (!canDecode(data, size) || !info.read(data, size))
+	{
+		return false;
+	}
+
+	const size_t numberOfValues = 3 * static_cast<size_t>(info.numberOfParticles);
+	size_t offset = kQuantisedPositionsHeaderSize;
+	_decoded.resize(numberOfValues);
+	if (info.isKeyframe())
+	{
+		if (size - offset != numberOfValues * sizeof(uint16_t))
+		{
+			return false;
+		}
+		std::memcpy(_decoded.data(), data + offset, numberOfValues * sizeof(uint16_t));
+	}
+	else
+	{
+		if (size - offset < 4)
+		{
+			return false;
+		}
+		const uint8_t* riceParameters = data + offset;
+		if (riceParameters[0] > kEscapeBits || riceParameters[1] > kEscapeBits ||
+			riceParameters[2] > kEscapeBits)
+		{
+			return false;
+		}
+
+		BitReader reader(data + offset + 4, size - offset - 4);
+		for (size_t i = 0; i < numberOfValues; ++i)
+		{
+			uint32_t change;
+			if (!reader.readRice(riceParameters[i % 3], &change))
+			{
+				return false;
+			}
+			_decoded[i] = static_cast<uint16_t>(static_cast<int32_t>(_values[i]) + unzigzag(change));
+		}
+		if (!reader.isAtEnd())
+		{
+			return false;
+		}
+	}
+
+	_decoded.swap(_values);
+	_frameIndex = info.frameIndex;
+	_hasFrame = true;
+
+	positions->resize(info.numberOfParticles);
+	for (size_t i = 0; i < positions->size(); ++i)
+	{
+		(*positions)[i] = Vector3(
+			static_cast<double>(info.origin[0]) + static_cast<double>(info.step[0]) * _values[3 * i],
+			static_cast<double>(info.origin[1]) + static_cast<double>(info.step[1]) * _values[3 * i + 1],
+			static_cast<double>(info.origin[2]) + static_cast<double>(info.step[2]) * _values[3 * i + 2]);
+	}
+	return true;
+}
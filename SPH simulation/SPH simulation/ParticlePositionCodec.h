@@ -0,0 +1,173 @@
+#pragma once
+#ifndef INCLUDE_PARTICLE_POSITION_CODEC_H_
+#define INCLUDE_PARTICLE_POSITION_CODEC_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "BoundingBox.h"
+#include "Vector3.h"
+
+//! Positions stored as raw float32 x, y, z triples.
+const uint32_t kPositionEncodingRaw = 0;
+
+//!
+//! Positions quantised to 16 bits per axis:
+//!   uint32 frame index
+//!   uint32 keyframe frame index, equal to the frame index for keyframes
+//!   uint32 reference frame index, the frame the deltas are against
+//!   uint32 number of particles
+//!   float32 x, y, z origin
+//!   float32 x, y, z quantisation step
+//! Keyframes follow with uint16 x, y, z values per particle. Other frames
+//! follow with one uint8 Rice parameter k per axis and a padding byte,
+//! then a bit stream, least significant bit first, with the x, y, z
+//! changes against the reference frame per particle. Each change is
+//! zigzag mapped (0, -1, 1, -2, ... to 0, 1, 2, 3, ...) and Rice coded as
+//! value >> k one bits, a zero bit and the k low bits of the value. A
+//! prefix of 32 one bits is followed by the value in 17 bits instead. A
+//! position is origin + step * value.
+//!
+const uint32_t kPositionEncodingQuantised = 1;
+
+//! Size of the fixed part of a kPositionEncodingQuantised payload.
+const size_t kQuantisedPositionsHeaderSize = 40;
+
+//!
+//! \brief Fixed fields at the start of a kPositionEncodingQuantised payload.
+//!
+struct QuantisedPositionsInfo
+{
+	uint32_t frameIndex = 0;
+	uint32_t keyframeIndex = 0;
+	uint32_t referenceFrameIndex = 0;
+	uint32_t numberOfParticles = 0;
+	float origin[3] = {};
+	float step[3] = {};
+
+	//! Returns true if the payload decodes without a previous frame.
+	bool isKeyframe() const { return frameIndex == keyframeIndex; }
+
+	//! Reads the fields from \p data. Returns false if \p size is too small.
+	bool read(const uint8_t* data, size_t size);
+};
+
+//!
+//! \brief Encodes particle positions as quantised keyframes and deltas.
+//!
+//! Positions are indexed by particle ID, so particle i of one frame is
+//! particle i of the next. Each axis is quantised to 16 bits over the
+//! bounds, with a step of twice the error bound but never finer than the
+//! bounds allow in 16 bits. Frames between keyframes store the change of
+//! every quantised value against the previous frame, Rice coded with the
+//! parameter that suits each axis in that frame, so slow particles take
+//! a few bits per axis. The deltas are
+//! taken between quantised values, so they are lossless and the error
+//! never exceeds half a step. Positions outside the bounds are clamped.
+//! A keyframe is written every keyframe interval, whenever the number of
+//! particles changes, and when the deltas would not be smaller.
+//!
+class ParticlePositionEncoder
+{
+public:
+	//! Sets the box the positions are quantised over, in simulation space.
+	void setBounds(const BoundingBox& bounds);
+
+	//! Returns the box the positions are quantised over.
+	const BoundingBox& bounds() const;
+
+	//! Sets the largest allowed difference between a position and its
+	//! decoded value, per axis.
+	void setErrorBound(double errorBound);
+
+	//! Returns the largest allowed difference per axis.
+	double errorBound() const;
+
+	//! Sets the number of frames from one keyframe to the next.
+	void setKeyframeInterval(size_t keyframeInterval);
+
+	//! Returns the number of frames from one keyframe to the next.
+	size_t keyframeInterval() const;
+
+	//! Returns the quantisation step of each axis.
+	Vector3 step() const;
+
+	//! Forces the next frame to be a keyframe.
+	void reset();
+
+	//!
+	//! \brief Encodes \p positions plus \p offset.
+	//!
+	//! \p offset moves the decoded positions without changing the
+	//! quantisation. Writes the payload to \p data and returns
+	//! kPositionEncodingQuantised.
+	//!
+	uint32_t encode(
+		uint32_t frameIndex,
+		const std::vector<Vector3>& positions,
+		const Vector3& offset,
+		std::vector<uint8_t>* data);
+
+private:
+	BoundingBox _bounds = BoundingBox(Vector3(0, 0, 0), Vector3(1, 1, 1));
+	double _errorBound = 0.0;
+	size_t _keyframeInterval = 30;
+
+	bool _hasFrame = false;
+	uint32_t _keyframeIndex = 0;
+	uint32_t _previousFrameIndex = 0;
+	size_t _framesSinceKeyframe = 0;
+
+	//! Quantised x, y, z of the previous frame.
+	std::vector<uint16_t> _previous;
+	std::vector<uint16_t> _current;
+	std::vector<uint32_t> _changes;
+
+	void writeHeader(
+		uint32_t frameIndex,
+		uint32_t keyframeIndex,
+		uint32_t referenceFrameIndex,
+		size_t numberOfParticles,
+		const Vector3& origin,
+		const Vector3& step,
+		std::vector<uint8_t>* data) const;
+};
+
+//!
+//! \brief Decodes a stream written by ParticlePositionEncoder.
+//!
+//! Frames must be decoded in order from a keyframe. To seek, decode the
+//! keyframe of the target frame and then every frame up to the target.
+//!
+class ParticlePositionDecoder
+{
+public:
+	//! Forgets the last decoded frame.
+	void reset();
+
+	//! Returns true if a frame has been decoded since the last reset.
+	bool hasFrame() const;
+
+	//! Returns the index of the last decoded frame.
+	uint32_t frameIndex() const;
+
+	//! Returns true if \p data is a keyframe or a delta against the last
+	//! decoded frame.
+	bool canDecode(const uint8_t* data, size_t size) const;
+
+	//!
+	//! \brief Decodes \p data into \p positions.
+	//!
+	//! Returns false, leaving the decoder unchanged, if the payload is
+	//! malformed or canDecode() is false.
+	//!
+	bool decode(const uint8_t* data, size_t size, std::vector<Vector3>* positions);
+
+private:
+	bool _hasFrame = false;
+	uint32_t _frameIndex = 0;
+	std::vector<uint16_t> _values;
+	std::vector<uint16_t> _decoded;
+};
+
+#endif
@@ -1,8 +1,58 @@
 #include "ParticleSystemData.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <cmath>
 #include <memory>
 
 static const size_t kDefaultHashGridResolution = 64;
 
+//! Smallest spatial hash table buildNeighbourSearcher() creates.
+static const size_t kMinHashTableSize = 1024;
+
+//! A dense grid is used while it has at most this many times the buckets the
+//! spatial hash would get. It never collides and keeps the stencil contiguous,
+//! which outweighs the prefix sum over the empty cells until the grid gets
+//! much larger than the particle count.
+static const size_t kMaxDenseGridOverhead = 64;
+
+//! Spreads the lower 21 bits of \p v so there are two zero bits between each.
+static uint64_t expandBitsBy3(uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffff;
+	v = (v | v << 16) & 0x1f0000ff0000ff;
+	v = (v | v << 8) & 0x100f00f00f00f00f;
+	v = (v | v << 4) & 0x10c30c30c30c30c3;
+	v = (v | v << 2) & 0x1249249249249249;
+	return v;
+}
+
+//! Returns the Z-order (Morton) key of the integer cell (x, y, z).
+static uint64_t mortonKey(uint64_t x, uint64_t y, uint64_t z)
+{
+	return expandBitsBy3(x) | (expandBitsBy3(y) << 1) | (expandBitsBy3(z) << 2);
+}
+
+//! Gathers \p values into the order given by \p keys, using \p scratch.
+template <typename T>
+static void permute(
+	std::vector<T>& values,
+	const std::vector<std::pair<uint64_t, size_t>>& keys,
+	std::vector<T>& scratch)
+{
+	if (values.size() < keys.size())
+	{
+		return;
+	}
+	scratch.resize(values.size());
+	for (size_t i = 0; i < keys.size(); ++i)
+	{
+		scratch[i] = values[keys[i].second];
+	}
+	std::copy(values.begin() + keys.size(), values.end(), scratch.begin() + keys.size());
+	values.swap(scratch);
+}
+
 ParticleSystemData::ParticleSystemData() : ParticleSystemData(0){}
 
 ParticleSystemData::ParticleSystemData(size_t numberOfParticles)
@@ -23,12 +73,32 @@ ParticleSystemData::~ParticleSystemData()
 void ParticleSystemData::resize(size_t newSize)
 {
 	_numberOfParticles = newSize;
+	_positions.resize(newSize);
+	_velocities.resize(newSize);
 	_forces.resize(newSize);
 	if (newSize > 0)
 	{
 		_waterContent.resize(newSize, (double)(1 / std::sqrt(_numberOfParticles)));
 	}
 	_sedimentCarried.resize(newSize, 0.0);
+
+	// New slots get fresh IDs. IDs are a permutation of 0..n-1, so the slot
+	// index of a new particle is never in use.
+	size_t oldSize = _particleIds.size();
+	_particleIds.resize(newSize);
+	for (size_t i = oldSize; i < newSize; ++i)
+	{
+		_particleIds[i] = i;
+	}
+
+	for (auto& attr : _scalarDataList)
+	{
+		attr.resize(newSize, 0.0);
+	}
+	for (auto& attr : _vectorDataList)
+	{
+		attr.resize(newSize, Vector3());
+	}
 }
 
 size_t ParticleSystemData::numberOfParticles() const
@@ -66,17 +136,47 @@ std::vector<double>& ParticleSystemData::sediment()
 	return _sedimentCarried;
 }
 
-void ParticleSystemData::setDensities(std::vector<double> densities)
+const std::vector<Vector3>& ParticleSystemData::positions() const
+{
+	return _positions;
+}
+
+const std::vector<Vector3>& ParticleSystemData::velocities() const
+{
+	return _velocities;
+}
+
+const std::vector<Vector3>& ParticleSystemData::forces() const
+{
+	return _forces;
+}
+
+const std::vector<double>& ParticleSystemData::pressures() const
+{
+	return _pressures;
+}
+
+const std::vector<double>& ParticleSystemData::water() const
+{
+	return _waterContent;
+}
+
+const std::vector<double>& ParticleSystemData::sediment() const
+{
+	return _sedimentCarried;
+}
+
+void ParticleSystemData::setDensities(const std::vector<double>& densities)
 {
 	_densities = densities;
 }
 
-void ParticleSystemData::setPressures(std::vector<double> pressures)
+void ParticleSystemData::setPressures(const std::vector<double>& pressures)
 {
 	_pressures = pressures;
 }
 
-double ParticleSystemData::mass()
+double ParticleSystemData::mass() const
 {
 	return _mass;
 }
@@ -86,7 +186,7 @@ void ParticleSystemData::setMass(double newMass)
 	_mass = newMass;
 }
 
-double ParticleSystemData::radius()
+double ParticleSystemData::radius() const
 {
 	return _radius;
 }
@@ -177,44 +277,322 @@ void ParticleSystemData::set(const ParticleSystemData & other)
 	_numberOfParticles = other._numberOfParticles;
 }
 
+const std::vector<size_t>& ParticleSystemData::particleIds() const
+{
+	return _particleIds;
+}
+
+unsigned int ParticleSystemData::spatialSortInterval() const
+{
+	return _spatialSortInterval;
+}
+
+void ParticleSystemData::setSpatialSortInterval(unsigned int interval)
+{
+	_spatialSortInterval = interval;
+	_substepsSinceSpatialSort = 0;
+}
+
+void ParticleSystemData::sortParticlesSpatially(double cellSize)
+{
+	const size_t n = numberOfParticles();
+	if (n < 2 || cellSize <= 0.0)
+	{
+		return;
+	}
+
+	Vector3 lowerCorner = _positions[0];
+	for (size_t i = 1; i < n; ++i)
+	{
+		lowerCorner.x = std::min(lowerCorner.x, _positions[i].x);
+		lowerCorner.y = std::min(lowerCorner.y, _positions[i].y);
+		lowerCorner.z = std::min(lowerCorner.z, _positions[i].z);
+	}
+
+	// Cells are clamped to 21 bits per axis to fit the 63-bit key.
+	const double maxCell = static_cast<double>(0x1fffff);
+	_sortKeys.resize(n);
+	parallelFor(0, n, [&](size_t i)
+	{
+		Vector3 cell = (_positions[i] - lowerCorner) / cellSize;
+		_sortKeys[i] = std::make_pair(
+			mortonKey(
+				static_cast<uint64_t>(std::min(cell.x, maxCell)),
+				static_cast<uint64_t>(std::min(cell.y, maxCell)),
+				static_cast<uint64_t>(std::min(cell.z, maxCell))),
+			i);
+	});
+
+	// Ties keep their current order, so an unchanged layout stays put.
+	std::sort(_sortKeys.begin(), _sortKeys.end());
+
+	permute(_positions, _sortKeys, _sortVectorScratch);
+	permute(_velocities, _sortKeys, _sortVectorScratch);
+	permute(_forces, _sortKeys, _sortVectorScratch);
+	permute(_densities, _sortKeys, _sortScalarScratch);
+	permute(_pressures, _sortKeys, _sortScalarScratch);
+	permute(_waterContent, _sortKeys, _sortScalarScratch);
+	permute(_sedimentCarried, _sortKeys, _sortScalarScratch);
+	permute(_particleIds, _sortKeys, _sortIdScratch);
+	for (auto& attr : _scalarDataList)
+	{
+		permute(attr, _sortKeys, _sortScalarScratch);
+	}
+	for (auto& attr : _vectorDataList)
+	{
+		permute(attr, _sortKeys, _sortVectorScratch);
+	}
+}
+
+void ParticleSystemData::setNeighbourSearchDomain(const BoundingBox & domain)
+{
+	_neighbourSearchDomain = domain;
+	_hasNeighbourSearchDomain = true;
+}
+
+bool ParticleSystemData::hasNeighbourSearchDomain() const
+{
+	return _hasNeighbourSearchDomain;
+}
+
+const BoundingBox & ParticleSystemData::neighbourSearchDomain() const
+{
+	return _neighbourSearchDomain;
+}
+
+double ParticleSystemData::neighbourSearchLoadFactor() const
+{
+	return _neighbourSearchLoadFactor;
+}
+
+void ParticleSystemData::setNeighbourSearchLoadFactor(double loadFactor)
+{
+	_neighbourSearchLoadFactor = std::max(loadFactor, 1e-3);
+}
+
 void ParticleSystemData::buildNeighbourSearcher(double maxSearchRadius)
 {
-	_neighbourSearcher = std::make_shared<PointHashGridSearcher>(
-		kDefaultHashGridResolution,
-		kDefaultHashGridResolution,
-		kDefaultHashGridResolution,
-		2.0*maxSearchRadius);
-	
+	if (_spatialSortInterval > 0 && ++_substepsSinceSpatialSort >= _spatialSortInterval)
+	{
+		sortParticlesSpatially(maxSearchRadius);
+		_substepsSinceSpatialSort = 0;
+	}
+
+	const size_t hashTableSize = std::max(kMinHashTableSize, static_cast<size_t>(
+		std::ceil(numberOfParticles() / _neighbourSearchLoadFactor)));
+
+	PointHashGridSearcher::SearchMode searchMode = PointHashGridSearcher::SearchMode::HashedStencil27;
+	size_t resolutionX = hashTableSize;
+	size_t resolutionY = 1;
+	size_t resolutionZ = 1;
+
+	if (_hasNeighbourSearchDomain)
+	{
+		// Two extra cells, so a domain that does not start on a cell
+		// boundary still does not wrap onto itself.
+		const size_t cellsX = static_cast<size_t>(std::ceil(_neighbourSearchDomain.width() / maxSearchRadius)) + 2;
+		const size_t cellsY = static_cast<size_t>(std::ceil(_neighbourSearchDomain.height() / maxSearchRadius)) + 2;
+		const size_t cellsZ = static_cast<size_t>(std::ceil(_neighbourSearchDomain.depth() / maxSearchRadius)) + 2;
+
+		if (cellsX * cellsY * cellsZ <= kMaxDenseGridOverhead * hashTableSize)
+		{
+			searchMode = PointHashGridSearcher::SearchMode::Stencil27;
+			resolutionX = cellsX;
+			resolutionY = cellsY;
+			resolutionZ = cellsZ;
+		}
+	}
+
+	if (_neighbourSearcher->searchMode() != searchMode)
+	{
+		_neighbourSearcher->setSearchMode(searchMode);
+	}
+	_neighbourSearcher->resize(resolutionX, resolutionY, resolutionZ, maxSearchRadius);
+
 	_neighbourSearcher->build(_positions);
 }
 
 void ParticleSystemData::buildNeighbourLists(double maxSearchRadius)
 {
-	_neighbourLists.clear();
-	_neighbourLists.resize(numberOfParticles());
+	const size_t n = numberOfParticles();
+	_neighbourOffsets.resize(n + 1);
+	_neighbourOffsets[0] = 0;
+
+	if (!_isUsingParallelNeighbourListBuild)
+	{
+		_neighbourIndices.clear();
+		for (size_t i = 0; i < n; ++i)
+		{
+			_neighbourSearcher->forEachNearbyPoint(_positions[i],
+				maxSearchRadius,
+				[&](size_t j, const Vector3&)
+			{
+				if (i != j)
+				{
+					_neighbourIndices.push_back(static_cast<uint32_t>(j));
+				}
+			});
+			_neighbourOffsets[i + 1] = _neighbourIndices.size();
+		}
+		buildPairCache();
+		return;
+	}
+
+	// Each chunk gathers its lists into its own buffer and stores the
+	// per-particle counts, which are then turned into offsets.
+	size_t numberOfChunks = parallelChunkCount(0, n);
+	if (_chunkNeighbourIndices.size() < numberOfChunks)
+	{
+		_chunkNeighbourIndices.resize(numberOfChunks);
+	}
+
+	parallelChunkFor(0, n, [&](size_t chunk, size_t chunkBegin, size_t chunkEnd)
+	{
+		auto& chunkIndices = _chunkNeighbourIndices[chunk];
+		chunkIndices.clear();
+		for (size_t i = chunkBegin; i < chunkEnd; ++i)
+		{
+			size_t start = chunkIndices.size();
+			_neighbourSearcher->forEachNearbyPoint(_positions[i],
+				maxSearchRadius,
+				[&](size_t j, const Vector3&)
+			{
+				if (i != j)
+				{
+					chunkIndices.push_back(static_cast<uint32_t>(j));
+				}
+			});
+			_neighbourOffsets[i + 1] = chunkIndices.size() - start;
+		}
+	});
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		_neighbourOffsets[i + 1] += _neighbourOffsets[i];
+	}
+	_neighbourIndices.resize(_neighbourOffsets[n]);
+
+	parallelChunkFor(0, n, [&](size_t chunk, size_t chunkBegin, size_t)
+	{
+		const auto& chunkIndices = _chunkNeighbourIndices[chunk];
+		std::copy(chunkIndices.begin(), chunkIndices.end(),
+			_neighbourIndices.begin() + _neighbourOffsets[chunkBegin]);
+	});
+
+	buildPairCache();
+}
+
+void ParticleSystemData::buildPairCache()
+{
+	if (!_isUsingPairCache)
+	{
+		_pairDistances.clear();
+		_pairDirections.clear();
+		return;
+	}
 
-	auto points = _positions;
+	_pairDistances.resize(_neighbourIndices.size());
+	_pairDirections.resize(_neighbourIndices.size());
 
-	for (size_t i = 0; i < numberOfParticles(); ++i)
+	parallelFor(0, numberOfParticles(), [&](size_t i)
 	{
-		Vector3 origin = points[i];
-		_neighbourLists[i].clear();
+		const Vector3& origin = _positions[i];
+		for (size_t k = _neighbourOffsets[i]; k < _neighbourOffsets[i + 1]; ++k)
+		{
+			Vector3 direction = _positions[_neighbourIndices[k]] - origin;
+			double distance = direction.length();
+			_pairDistances[k] = distance;
+			_pairDirections[k] = (distance > 0.0) ? direction / distance : Vector3();
+		}
+	});
+}
+
+bool ParticleSystemData::isUsingPairCache() const
+{
+	return _isUsingPairCache;
+}
 
-		_neighbourSearcher->forEachNearbyPoint(origin,
-			maxSearchRadius,
-			[&](size_t j, const Vector3&)
+void ParticleSystemData::setIsUsingPairCache(bool isUsingPairCache)
+{
+	_isUsingPairCache = isUsingPairCache;
+}
+
+const std::vector<double>& ParticleSystemData::pairDistances() const
+{
+	return _pairDistances;
+}
+
+const std::vector<Vector3>& ParticleSystemData::pairDirections() const
+{
+	return _pairDirections;
+}
+
+bool ParticleSystemData::isUsingParallelNeighbourListBuild() const
+{
+	return _isUsingParallelNeighbourListBuild;
+}
+
+void ParticleSystemData::setIsUsingParallelNeighbourListBuild(bool isUsingParallelBuild)
+{
+	_isUsingParallelNeighbourListBuild = isUsingParallelBuild;
+}
+
+const std::vector<size_t>& ParticleSystemData::neighbourOffsets() const
+{
+	return _neighbourOffsets;
+}
+
+const std::vector<uint32_t>& ParticleSystemData::neighbourIndices() const
+{
+	return _neighbourIndices;
+}
+
+void ParticleSystemData::buildHalfNeighbourLists()
+{
+	const size_t n = numberOfParticles();
+	_halfNeighbourOffsets.resize(n + 1);
+	_halfNeighbourOffsets[0] = 0;
+
+	parallelFor(0, n, [&](size_t i)
+	{
+		size_t count = 0;
+		for (size_t k = _neighbourOffsets[i]; k < _neighbourOffsets[i + 1]; ++k)
 		{
-			if (i != j)
+			if (_neighbourIndices[k] > i)
 			{
-				_neighbourLists[i].push_back(j);
+				++count;
 			}
-		});
+		}
+		_halfNeighbourOffsets[i + 1] = count;
+	});
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		_halfNeighbourOffsets[i + 1] += _halfNeighbourOffsets[i];
 	}
+	_halfNeighbourEntries.resize(_halfNeighbourOffsets[n]);
+
+	parallelFor(0, n, [&](size_t i)
+	{
+		size_t h = _halfNeighbourOffsets[i];
+		for (size_t k = _neighbourOffsets[i]; k < _neighbourOffsets[i + 1]; ++k)
+		{
+			if (_neighbourIndices[k] > i)
+			{
+				_halfNeighbourEntries[h++] = k;
+			}
+		}
+	});
 }
 
-const std::vector<std::vector<size_t>>& ParticleSystemData::neighborLists() const
+const std::vector<size_t>& ParticleSystemData::halfNeighbourOffsets() const
 {
-	return _neighbourLists;
+	return _halfNeighbourOffsets;
+}
+
+const std::vector<size_t>& ParticleSystemData::halfNeighbourEntries() const
+{
+	return _halfNeighbourEntries;
 }
 
 PointNeighbourSearcherPtr ParticleSystemData::neighborSearcher()
@@ -222,6 +600,11 @@ PointNeighbourSearcherPtr ParticleSystemData::neighborSearcher()
 	return _neighbourSearcher;
 }
 
+const PointHashGridSearcherPtr& ParticleSystemData::hashGridSearcher() const
+{
+	return _neighbourSearcher;
+}
+
 double ParticleSystemData::targetDensity() const
 {
 	return _targetDensity;
@@ -245,7 +628,15 @@ ParticleSystemData::doubleArray & ParticleSystemData::scalarDataAt(size_t idx)
 {
 	return _scalarDataList.at(idx);
 }
+const ParticleSystemData::doubleArray & ParticleSystemData::scalarDataAt(size_t idx) const
+{
+	return _scalarDataList.at(idx);
+}
 ParticleSystemData::vectorArray & ParticleSystemData::vectorDataAt(size_t idx)
 {
 	return _vectorDataList.at(idx);
 }
+const ParticleSystemData::vectorArray & ParticleSystemData::vectorDataAt(size_t idx) const
+{
+	return _vectorDataList.at(idx);
+}
@@ -3,9 +3,12 @@
 #define INCLUDE_PARTICLE_SYSTEM_DATA_H_
 
 #include <math.h>
+#include <cstdint>
 #include <memory>
+#include <utility>
 #include <vector>
 #include "Vector3.h"
+#include "BoundingBox.h"
 #include "PointHashGridSearcher.h"
 
 class ParticleSystemData
@@ -25,17 +28,27 @@ public:
 	std::vector<Vector3>& velocities();
 	std::vector<Vector3>& forces();
 	std::vector<double>& pressures();
-	void setDensities(std::vector<double> densities);
-	void setPressures(std::vector<double> pressures);
+
+	//! Read-only views of the particle arrays. Bind them to a const
+	//! reference, copying them costs a full array per call.
+	const std::vector<Vector3>& positions() const;
+	const std::vector<Vector3>& velocities() const;
+	const std::vector<Vector3>& forces() const;
+	const std::vector<double>& pressures() const;
+
+	void setDensities(const std::vector<double>& densities);
+	void setPressures(const std::vector<double>& pressures);
 
 	std::vector<double>& water();
 	std::vector<double>& sediment();
+	const std::vector<double>& water() const;
+	const std::vector<double>& sediment() const;
 
-	double mass();
+	double mass() const;
 
 	virtual void setMass(double newMass);
 
-	double radius();
+	double radius() const;
 
 	virtual void setRadius(double newRadius);
 
@@ -51,13 +64,145 @@ public:
 
 	void set(const ParticleSystemData& other);
 
+	//!
+	//! \brief Returns the stable ID of the particle stored in each slot.
+	//!
+	//! IDs follow the emission order and are kept when the particles are
+	//! reordered by sortParticlesSpatially(), so output can be written in ID
+	//! order to keep a consistent particle identity between frames.
+	//!
+	const std::vector<size_t>& particleIds() const;
+
+	//! Returns the number of substeps between spatial sorts, 0 if disabled.
+	unsigned int spatialSortInterval() const;
+
+	//!
+	//! \brief Sets how often the particles are sorted spatially.
+	//!
+	//! When enabled, buildNeighbourSearcher() calls sortParticlesSpatially()
+	//! every \p interval substeps with the search radius as cell size. Zero
+	//! disables sorting (default).
+	//!
+	void setSpatialSortInterval(unsigned int interval);
+
+	//!
+	//! \brief Reorders every per-particle array by Z-order of its grid cell.
+	//!
+	//! Particles close in space end up close in memory, which keeps the
+	//! neighbour loops cache friendly. Positions, velocities, forces, water,
+	//! sediment, the particle IDs and all custom scalar and vector data layers
+	//! are permuted together. Neighbour lists and the searcher have to be
+	//! rebuilt afterwards.
+	//!
+	void sortParticlesSpatially(double cellSize);
+
+	//!
+	//! \brief Sets the region the particles are expected to stay in.
+	//!
+	//! buildNeighbourSearcher() sizes a dense grid over this region when it
+	//! fits the bucket budget given by the load factor, and falls back to a
+	//! spatial hash otherwise. Particles outside the region are still found,
+	//! they only share buckets with particles inside it.
+	//!
+	void setNeighbourSearchDomain(const BoundingBox& domain);
+
+	//! Returns true if a neighbour search domain was set.
+	bool hasNeighbourSearchDomain() const;
+
+	//! Returns the neighbour search domain.
+	const BoundingBox& neighbourSearchDomain() const;
+
+	//! Returns the target number of particles per bucket.
+	double neighbourSearchLoadFactor() const;
+
+	//!
+	//! \brief Sets the target number of particles per bucket.
+	//!
+	//! The spatial hash gets about numberOfParticles / loadFactor buckets,
+	//! and a dense grid is used while it needs at most a few times that.
+	//! Default is 0.5.
+	//!
+	void setNeighbourSearchLoadFactor(double loadFactor);
+
+	//! Rebuilds the searcher over the current positions. The searcher object
+	//! is reused and only resized when the spacing or resolution changes.
 	void buildNeighbourSearcher(double maxSearchRadius);
 	void buildNeighbourLists(double maxSearchRadius);
+
+	//! Returns true if neighbour lists are built across the worker threads.
+	bool isUsingParallelNeighbourListBuild() const;
+
+	//!
+	//! \brief Enables or disables the parallel neighbour list build.
+	//!
+	//! Both paths produce identical lists; the serial one is kept so the two
+	//! can be compared. Default is true.
+	//!
+	void setIsUsingParallelNeighbourListBuild(bool isUsingParallelBuild);
 	
-	const std::vector<std::vector<size_t>>& neighborLists() const;
+	//!
+	//! \brief Returns where each particle's neighbours start in neighbourIndices().
+	//!
+	//! The neighbours of particle i are neighbourIndices()[k] for k in
+	//! [neighbourOffsets()[i], neighbourOffsets()[i + 1]).
+	//!
+	const std::vector<size_t>& neighbourOffsets() const;
+
+	//! Returns the neighbour indices of all particles, stored back to back.
+	const std::vector<uint32_t>& neighbourIndices() const;
+
+	//! Returns true if buildNeighbourLists() also fills the pair cache.
+	bool isUsingPairCache() const;
+
+	//!
+	//! \brief Enables or disables the pair cache.
+	//!
+	//! When enabled, buildNeighbourLists() stores the distance and the unit
+	//! direction of every neighbour pair, so the passes of a substep read
+	//! them instead of recomputing the square root each time. Costs 32 bytes
+	//! per neighbour entry. Default is false.
+	//!
+	void setIsUsingPairCache(bool isUsingPairCache);
+
+	//!
+	//! \brief Returns the distance of each neighbour pair.
+	//!
+	//! Entry k belongs to the pair (i, neighbourIndices()[k]), see
+	//! neighbourOffsets(). Only valid while isUsingPairCache() is true and
+	//! the positions have not moved since the lists were built.
+	//!
+	const std::vector<double>& pairDistances() const;
+
+	//! Returns the unit direction from particle i to neighbourIndices()[k]
+	//! for each neighbour pair, or zero if the two coincide.
+	const std::vector<Vector3>& pairDirections() const;
+
+	//!
+	//! \brief Builds the half neighbour lists from the full ones.
+	//!
+	//! The half list of particle i holds only the neighbours j > i, so every
+	//! pair appears once. Has to be called after buildNeighbourLists().
+	//!
+	void buildHalfNeighbourLists();
+
+	//! Returns where each particle's half list starts in halfNeighbourEntries().
+	const std::vector<size_t>& halfNeighbourOffsets() const;
+
+	//!
+	//! \brief Returns the half lists of all particles, stored back to back.
+	//!
+	//! Each entry is a position k in neighbourIndices(), so the neighbour is
+	//! neighbourIndices()[k] and k can index other per-pair data of the full
+	//! lists.
+	//!
+	const std::vector<size_t>& halfNeighbourEntries() const;
 
 	PointNeighbourSearcherPtr neighborSearcher();
 
+	//! Returns the concrete hash grid searcher, for the inlinable
+	//! PointHashGridSearcher::forEachNearbyPoint() overload.
+	const PointHashGridSearcherPtr& hashGridSearcher() const;
+
 	double targetDensity() const;
 
 	//!
@@ -83,9 +228,15 @@ public:
 	//! Returns custom scalar data layer at given index (mutable).
 	doubleArray& scalarDataAt(size_t idx);
 
+	//! Returns custom scalar data layer at given index (immutable).
+	const doubleArray& scalarDataAt(size_t idx) const;
+
 	//! Returns custom vector data layer at given index (mutable).
 	vectorArray& vectorDataAt(size_t idx);
 
+	//! Returns custom vector data layer at given index (immutable).
+	const vectorArray& vectorDataAt(size_t idx) const;
+
 private:
 	size_t _numberOfParticles = 0;
 	std::vector<Vector3> _positions;
@@ -103,8 +254,35 @@ private:
 	double _radius = 1e-3;
 	double _mass = 10;
 
-	PointNeighbourSearcherPtr _neighbourSearcher;
-	std::vector<std::vector<size_t>> _neighbourLists;
+	std::vector<size_t> _particleIds;
+
+	unsigned int _spatialSortInterval = 0;
+	unsigned int _substepsSinceSpatialSort = 0;
+
+	//! Scratch buffers for sortParticlesSpatially(), kept between sorts.
+	std::vector<std::pair<uint64_t, size_t>> _sortKeys;
+	std::vector<size_t> _sortIdScratch;
+	vectorArray _sortVectorScratch;
+	doubleArray _sortScalarScratch;
+
+	PointHashGridSearcherPtr _neighbourSearcher;
+	BoundingBox _neighbourSearchDomain;
+	bool _hasNeighbourSearchDomain = false;
+	double _neighbourSearchLoadFactor = 0.5;
+	std::vector<size_t> _neighbourOffsets;
+	std::vector<uint32_t> _neighbourIndices;
+	std::vector<size_t> _halfNeighbourOffsets;
+	std::vector<size_t> _halfNeighbourEntries;
+	bool _isUsingPairCache = false;
+	std::vector<double> _pairDistances;
+	std::vector<Vector3> _pairDirections;
+	bool _isUsingParallelNeighbourListBuild = true;
+
+	//! Per-chunk scratch lists for the parallel build, kept between substeps.
+	std::vector<std::vector<uint32_t>> _chunkNeighbourIndices;
+
+	//! Fills the pair cache from the current lists, or drops it if disabled.
+	void buildPairCache();
 
 	std::vector<vectorArray> _vectorDataList;
 	std::vector<doubleArray> _scalarDataList;
@@ -1,4 +1,5 @@
 #include "ParticleSystemSolver.h"
+#include "Parallel.h"
 
 ParticleSystemSolver::ParticleSystemSolver()
 	: ParticleSystemSolver(1e-3, 1e-3){}
@@ -62,6 +63,11 @@ const std::shared_ptr<ParticleSystemData> ParticleSystemSolver::particleSystemDa
 	return _particleSystemData;
 }
 
+size_t ParticleSystemSolver::numberOfScratchAllocations() const
+{
+	return _numberOfScratchAllocations;
+}
+
 const ColliderPtr & ParticleSystemSolver::collider() const
 {
 	return _collider;
@@ -79,18 +85,18 @@ const ParticleEmitterPtr & ParticleSystemSolver::emitter() const
 
 void ParticleSystemSolver::beginAdvanceTimeStep(double timeIntervalInSeconds)
 {
-	_particleSystemData->forces().clear();
-	_particleSystemData->forces().resize(_particleSystemData->numberOfParticles());
+	auto& forces = _particleSystemData->forces();
+	resizeScratchBuffer(forces, _particleSystemData->numberOfParticles());
+	std::fill(forces.begin(), forces.end(), Vector3());
 	
 	updateCollider(timeIntervalInSeconds);
 
 	updateEmitter(timeIntervalInSeconds);
 
+	// Both are overwritten by timeIntegration().
 	size_t n = _particleSystemData->numberOfParticles();
-	_newPositions.clear();
-	_newPositions.resize(n);
-	_newVelocities.clear();
-	_newVelocities.resize(n);
+	resizeScratchBuffer(_newPositions, n);
+	resizeScratchBuffer(_newVelocities, n);
 	
 	onBeginAdvanceTimeStep(timeIntervalInSeconds);
 
@@ -101,58 +107,94 @@ void ParticleSystemSolver::endAdvanceTimeStep(double timeIntervalInSeconds)
 	onEndAdvanceTimeStep(timeIntervalInSeconds);
 	size_t n = _particleSystemData->numberOfParticles();
 	double nsqrt = std::sqrt(n);
-	for (size_t i = 0; i < n; i++)
+	const auto& surface = _collider->surface();
+	const auto& positions = _particleSystemData->positions();
+	const double radius = _particleSystemData->radius();
+	auto& water = _particleSystemData->water();
+	auto& sediment = _particleSystemData->sediment();
+	// The first scalar channel holds the SPH densities.
+	const auto& densities = _particleSystemData->scalarDataAt(0);
+
+	// Every droplet erodes against the heightfield as it was at the start of
+	// the stage and records its height changes per chunk. The changes are
+	// applied afterwards in particle order, so the result does not depend
+	// on the number of threads.
+	const size_t numberOfChunks = parallelChunkCount(0, n);
+	if (_chunkHeightDeltas.size() < numberOfChunks)
 	{
-		if (_newPositions[i].z <= 0)
-		{
-			_newPositions[i].z = 0;
-		}
-		if (_newPositions[i].x <= 0)
-		{
-			_newPositions[i].x = 0;
-		}
-		if (_collider->surface()->closestDistance(_newPositions[i]) <= _particleSystemData->radius() + 0.03)
-		{
-			double deltaHeight = _newPositions[i].y - _particleSystemData->positions()[i].y;
-			double speed = _newVelocities[i].length()/nsqrt*25;
-
-			// Calculate the droplet's sediment capacity 
-			// (higher when moving fast down a slope and contains lots of water)
-			double sedimentCapacity = std::max(-deltaHeight * speed * _particleSystemData->water()[i] * 4, 0.01 / nsqrt) * _particleSystemData->scalarDataAt(0)[i] / 850;
+		_chunkHeightDeltas.resize(numberOfChunks);
+	}
+	for (auto& deltas : _chunkHeightDeltas)
+	{
+		deltas.clear();
+	}
 
-			// If carrying more sediment than capacity, or if flowing uphill:
-			if (_particleSystemData->sediment()[i] > sedimentCapacity || deltaHeight > 0 && _particleSystemData->sediment()[i] > 0)
+	parallelChunkFor(0, n, [&](size_t chunk, size_t chunkBegin, size_t chunkEnd)
+	{
+		auto& deltas = _chunkHeightDeltas[chunk];
+		for (size_t i = chunkBegin; i < chunkEnd; i++)
+		{
+			if (_newPositions[i].z <= 0)
 			{
-				// If moving uphill (deltaHeight > 0) try fill up to the current height 
-				// otherwise deposit a fraction of the excess sediment
-				double amountToDeposit =
-					((deltaHeight > 0) ? std::min(deltaHeight, _particleSystemData->sediment()[i]) :
-					(_particleSystemData->sediment()[i] - sedimentCapacity)) * 0.3f;
-
-				_particleSystemData->sediment()[i] -= amountToDeposit;
-
-				_collider->surface()->depositToNode(_newPositions[i], amountToDeposit);
+				_newPositions[i].z = 0;
 			}
-			else
+			if (_newPositions[i].x <= 0)
 			{
-				// Erode a fraction of the droplet's current carry capacity.
-				// Clamp the erosion to the change in height so that it doesn't 
-				// dig a hole in the terrain behind the droplet
-				double amountToErode = std::min((sedimentCapacity - _particleSystemData->sediment()[i]) *
-					0.3f,
-					-deltaHeight);
-
-				_particleSystemData->sediment()[i] += _collider->surface()->erodeNode(_newPositions[i], amountToErode);
+				_newPositions[i].x = 0;
 			}
-			_particleSystemData->water()[i] *= (1 - 0.05);
-			if (_particleSystemData->water()[i] <= 0)
+			if (surface->closestDistance(_newPositions[i]) <= radius + 0.03)
 			{
-				_newPositions[i] = _emitter->getRandomSpawnPos();
-				_newVelocities[i] = Vector3();
-				_particleSystemData->water()[i] = 1 / nsqrt;
-				_particleSystemData->sediment()[i] = 0;
+				double deltaHeight = _newPositions[i].y - positions[i].y;
+				double speed = _newVelocities[i].length()/nsqrt*25;
+
+				// Calculate the droplet's sediment capacity 
+				// (higher when moving fast down a slope and contains lots of water)
+				double sedimentCapacity = std::max(-deltaHeight * speed * water[i] * 4, 0.01 / nsqrt) * densities[i] / 850;
+
+				// If carrying more sediment than capacity, or if flowing uphill:
+				if (sediment[i] > sedimentCapacity || (deltaHeight > 0 && sediment[i] > 0))
+				{
+					// If moving uphill (deltaHeight > 0) try fill up to the current height 
+					// otherwise deposit a fraction of the excess sediment
+					double amountToDeposit =
+						((deltaHeight > 0) ? std::min(deltaHeight, sediment[i]) :
+						(sediment[i] - sedimentCapacity)) * 0.3f;
+
+					sediment[i] -= amountToDeposit;
+
+					surface->depositToNodeDeferred(_newPositions[i], amountToDeposit, deltas);
+				}
+				else
+				{
+					// Erode a fraction of the droplet's current carry capacity.
+					// Clamp the erosion to the change in height so that it doesn't 
+					// dig a hole in the terrain behind the droplet
+					double amountToErode = std::min((sedimentCapacity - sediment[i]) *
+						0.3f,
+						-deltaHeight);
+
+					sediment[i] += surface->erodeNodeDeferred(_newPositions[i], amountToErode, deltas);
+				}
+				water[i] *= (1 - 0.05);
 			}
 		}
+	});
+
+	for (size_t chunk = 0; chunk < numberOfChunks; ++chunk)
+	{
+		surface->applyHeightDeltas(_chunkHeightDeltas[chunk]);
+	}
+
+	// The emitter's random generator is not thread-safe.
+	for (size_t i = 0; i < n; i++)
+	{
+		if (water[i] <= 0)
+		{
+			_newPositions[i] = _emitter->getRandomSpawnPos();
+			_newVelocities[i] = Vector3();
+			water[i] = 1 / nsqrt;
+			sediment[i] = 0;
+		}
 	}
 
 	for (size_t i = 0; i < n; i++)
@@ -174,6 +216,13 @@ void ParticleSystemSolver::onInitialise()
 {
 	updateCollider(0.0);
 	updateEmitter(0.0);
+
+	// Particles leaving the collider bounds are respawned, so its bounding
+	// box is where the neighbour search has to be dense.
+	if (_collider != nullptr)
+	{
+		_particleSystemData->setNeighbourSearchDomain(_collider->surface()->boundingBox());
+	}
 }
 
 void ParticleSystemSolver::timeIntegration(double timeIntervalInSeconds)
@@ -214,11 +263,14 @@ void ParticleSystemSolver::resolveCollision(
 	{
 		size_t numberOfParticles = _particleSystemData->numberOfParticles();
 		const double radius = _particleSystemData->radius();
+		const BoundingBox bounds = _collider->surface()->boundingBox();
 
+		// The emitter's random generator is not thread-safe, so respawning
+		// runs serially before the parallel collision pass.
 		for (size_t i = 0; i < numberOfParticles; i++)
 		{
 			//respawn if not inside the bounds of the heightmap
-			if (!_collider->surface()->boundingBox().contains(newPositions[i]) || newPositions[i].z <= 0 || newPositions[i].x <= 0)
+			if (!bounds.contains(newPositions[i]) || newPositions[i].z <= 0 || newPositions[i].x <= 0)
 			{
 				newPositions[i] = _emitter->getRandomSpawnPos();
 				newVelocities[i] = Vector3(); 
@@ -226,12 +278,13 @@ void ParticleSystemSolver::resolveCollision(
 				_particleSystemData->sediment()[i] = 0;
 
 			}
-			_collider->resolveCollision(
-				radius,
-				_restitutionCoefficient,
-				&newPositions[i],
-				&newVelocities[i]);
 		}
+
+		_collider->resolveCollisions(
+			newPositions,
+			newVelocities,
+			radius,
+			_restitutionCoefficient);
 	}
 }
 
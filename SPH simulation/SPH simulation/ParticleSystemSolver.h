@@ -2,6 +2,7 @@
 #ifndef INCLUDE_PARTICLE_SYSTEM_SOLVER_H_
 #define INCLUDE_PARTICLE_SYSTEM_SOLVER_H_
 
+#include <algorithm>
 #include <vector>
 #include <memory>
 
@@ -30,6 +31,15 @@ public:
 	const ParticleEmitterPtr& emitter() const;
 
 	void setEmitter(const ParticleEmitterPtr& newEmitter);
+
+	//!
+	//! \brief Returns how often a scratch buffer had to grow.
+	//!
+	//! Temporary per-particle buffers of the solvers only grow and are
+	//! reused across substeps and frames. Once the particle count stops
+	//! growing this number stays constant.
+	//!
+	size_t numberOfScratchAllocations() const;
 	
 protected:
 	void onAdvanceTimeStep(double timeIntervalInSeconds) override;
@@ -51,6 +61,15 @@ protected:
 
 	void onInitialise() override;
 
+	//!
+	//! \brief Resizes a scratch buffer without ever shrinking its storage.
+	//!
+	//! Existing elements are kept and new ones are value-initialised, so
+	//! buffers that are accumulated into have to be cleared by the caller.
+	//!
+	template <typename T>
+	void resizeScratchBuffer(std::vector<T>& buffer, size_t size);
+
 private:
 	std::shared_ptr<ParticleSystemData> _particleSystemData;
 
@@ -71,6 +90,23 @@ private:
 	ParticleSystemData::vectorArray _newVelocities;
 	ColliderPtr _collider;
 	ParticleEmitterPtr _emitter;
+
+	//! Height changes recorded by each chunk of the erosion stage.
+	std::vector<std::vector<HeightDelta>> _chunkHeightDeltas;
+
+	size_t _numberOfScratchAllocations = 0;
 };
 
+template <typename T>
+inline void ParticleSystemSolver::resizeScratchBuffer(std::vector<T>& buffer, size_t size)
+{
+	if (buffer.capacity() < size)
+	{
+		// Grow geometrically, emitters add particles a few at a time.
+		buffer.reserve(std::max(size, 2 * buffer.capacity()));
+		++_numberOfScratchAllocations;
+	}
+	buffer.resize(size);
+}
+
 #endif
\ No newline at end of file
@@ -1,4 +1,9 @@
 #include "PciSphSystemSolver.h"
+#include "Parallel.h"
+#include "SphSimdKernels.h"
+
+#include <algorithm>
+#include <cmath>
 
 
 
@@ -22,84 +27,90 @@ void PciSphSystemSolver::accumulatePressureForce(double timeIntervalInSeconds)
 	const size_t numberOfParticles = particles->numberOfParticles();
 	const double targetDensity = particles->targetDensity();
 	const double mass = particles->mass();
+	const double negativeScale = negativePressureScale();
 
 	const double delta = computeDelta(timeIntervalInSeconds);
-	std::vector<double> ds(numberOfParticles, 0.0);
+	auto& ds = _predictedDensities;
+	resizeScratchBuffer(ds, numberOfParticles);
 	SphStdKernel kernel(particles->kernelRadius());
-
+	const auto& offsets = particles->neighbourOffsets();
+	const auto& indices = particles->neighbourIndices();
+	auto& pressures = particles->pressures();
+	auto& densities = particles->densities();
+	auto& positions = particles->positions();
+	auto& velocities = particles->velocities();
+	auto& forces = particles->forces();
 
 	//init buffers
-	for (size_t i = 0; i < numberOfParticles; i++)
+	pressures.resize(numberOfParticles);
+	parallelFor(0, numberOfParticles, [&](size_t i)
 	{
-		if (i >= particles->pressures().size())
-		{
-			sphSystemData()->pressures().push_back(0.0);
-		}
-		else
-		{
-			sphSystemData()->pressures()[i] = 0.0;
-		}
+		pressures[i] = 0.0;
 		_pressureForces[i] = Vector3(0,0,0);
 		_densityErrors[i] = 0.0;
-		ds[i] = particles->densities()[i];
-	}
+		ds[i] = densities[i];
+	});
+
+	// Per-chunk maxima of the density error, combined after each sweep.
+	auto& chunkMaxDensityErrors = _chunkMaxDensityErrors;
+	resizeScratchBuffer(chunkMaxDensityErrors, parallelChunkCount(0, numberOfParticles));
 
 	for (unsigned int k = 0; k < _maxNumberOfIterations; ++k)
 	{
 		//predict vel and pos
-		for (size_t i = 0; i < numberOfParticles; i++)
+		parallelFor(0, numberOfParticles, [&](size_t i)
 		{
-			_tempVelocities[i] = particles->velocities()[i]+((particles->forces()[i]+(_pressureForces[i]))*(timeIntervalInSeconds / mass));
-			_tempPositions[i] = particles->positions()[i]+(_tempVelocities[i]*(timeIntervalInSeconds));
-		}
+			_tempVelocities[i] = velocities[i]+((forces[i]+(_pressureForces[i]))*(timeIntervalInSeconds / mass));
+			_tempPositions[i] = positions[i]+(_tempVelocities[i]*(timeIntervalInSeconds));
+		});
 		//resolve collisions
 		resolveCollision(
 			_tempPositions,
 			_tempVelocities);
 
 		//compute pressure from density error
-		for (size_t i = 0; i < numberOfParticles; i++)
+		std::fill(chunkMaxDensityErrors.begin(), chunkMaxDensityErrors.end(), 0.0);
+		parallelChunkFor(0, numberOfParticles, [&](size_t chunk, size_t chunkBegin, size_t chunkEnd)
 		{
-			double weightSum = 0.0;
-			const auto& neighbours = particles->neighborLists()[i];
-
-			for (size_t j : neighbours)
+			double chunkMaxDensityError = 0.0;
+			for (size_t i = chunkBegin; i < chunkEnd; i++)
 			{
-				double dist = _tempPositions[j].distanceTo(_tempPositions[i]);
-				weightSum += kernel(dist);
+				double weightSum = sumStdKernelAt(
+					_tempPositions,
+					i,
+					indices.data() + offsets[i],
+					offsets[i + 1] - offsets[i],
+					kernel);
+
+				double density = mass * weightSum;
+				double densityError = (density - targetDensity);
+				double pressure = delta * densityError;
+
+				if (pressure < 0.0)
+				{
+					pressure *= negativeScale;
+					densityError *= negativeScale;
+				}
+				pressures[i] += pressure;
+				ds[i] = density;
+				_densityErrors[i] = densityError;
+				chunkMaxDensityError = std::max(chunkMaxDensityError, std::abs(densityError));
 			}
-			weightSum += kernel(0);
-
-			double density = mass * weightSum;
-			double densityError = (density - targetDensity);
-			double pressure = delta * densityError;
-
-			if (pressure < 0.0)
-			{
-				pressure *= negativePressureScale();
-				densityError *= negativePressureScale();
-			}
-			else
-			{
-				pressure = pressure;
-			}
-			sphSystemData()->pressures()[i] += pressure;
-			ds[i] = density;
-			_densityErrors[i] = densityError;
-		}
+			chunkMaxDensityErrors[chunk] = chunkMaxDensityError;
+		});
 
 		//compute pressure gradient force
-		for (size_t i = 0; i < _pressureForces.size(); i++)
+		parallelFor(0, numberOfParticles, [&](size_t i)
 		{
 			_pressureForces[i] = Vector3();
-		}
-		SphSystemSolver::accumulatePressureForce(particles->positions(), ds, particles->pressures(), _pressureForces);
+		});
+		SphSystemSolver::accumulatePressureForce(positions, ds, pressures, _pressureForces);
 
 		//compute max density error
 		double maxDensityError = 0.0;
-		for (size_t i = 0; i < numberOfParticles; ++i)
+		for (double chunkMaxDensityError : chunkMaxDensityErrors)
 		{
-			maxDensityError = std::max(std::abs(maxDensityError), std::abs(_densityErrors[i]));
+			maxDensityError = std::max(maxDensityError, chunkMaxDensityError);
 		}
 		double densityErrorRatio = maxDensityError / targetDensity;
 
@@ -109,33 +120,35 @@ void PciSphSystemSolver::accumulatePressureForce(double timeIntervalInSeconds)
 		}
 	}
 
-		//accumulate pressure force
-		for (size_t i = 0; i < numberOfParticles; i++)
-		{
-			sphSystemData()->forces()[i] += _pressureForces[i];
-		}
-	
+	//accumulate pressure force
+	parallelFor(0, numberOfParticles, [&](size_t i)
+	{
+		forces[i] += _pressureForces[i];
+	});
 }
 
 void PciSphSystemSolver::onBeginAdvanceTimeStep(double timeStepInSeconds)
 {
 	SphSystemSolver::onBeginAdvanceTimeStep(timeStepInSeconds);
 
-	// Allocate temp buffers
+	// Allocate temp buffers, accumulatePressureForce() initialises them
 	size_t numberOfParticles = particleSystemData()->numberOfParticles();
-	_tempPositions.clear();
-	_tempPositions.resize(numberOfParticles);
-	_tempVelocities.clear();
-	_tempVelocities.resize(numberOfParticles);
-	_pressureForces.clear();
-	_pressureForces.resize(numberOfParticles);
-	_densityErrors.clear();
-	_densityErrors.resize(numberOfParticles);
+	resizeScratchBuffer(_tempPositions, numberOfParticles);
+	resizeScratchBuffer(_tempVelocities, numberOfParticles);
+	resizeScratchBuffer(_pressureForces, numberOfParticles);
+	resizeScratchBuffer(_densityErrors, numberOfParticles);
 }
 
 double PciSphSystemSolver::computeDelta(double timeStepInSeconds)
 {
 	auto particles = sphSystemData();
+	if (_deltaParticles == particles.get() &&
+		_deltaParameterRevision == particles->parameterRevision())
+	{
+		return (std::fabs(_deltaDenominator) > 0.0) ?
+			-1 / (computeBeta(timeStepInSeconds) * _deltaDenominator) : 0;
+	}
+
 	const double kernelRadius = particles->kernelRadius();
 
 	std::vector<Vector3> points;
@@ -172,6 +185,10 @@ double PciSphSystemSolver::computeDelta(double timeStepInSeconds)
 
 	denom += -denom1.dot(denom1) - denom2;
 
+	_deltaDenominator = denom;
+	_deltaParameterRevision = particles->parameterRevision();
+	_deltaParticles = particles.get();
+
 	return (std::fabs(denom) > 0.0) ?
 		-1 / (computeBeta(timeStepInSeconds) * denom) : 0;
 }
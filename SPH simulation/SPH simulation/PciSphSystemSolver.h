@@ -31,7 +31,22 @@ private:
 	ParticleSystemData::vectorArray _tempVelocities;
 	ParticleSystemData::vectorArray _pressureForces;
 	ParticleSystemData::doubleArray _densityErrors;
-
+	ParticleSystemData::doubleArray _predictedDensities;
+	ParticleSystemData::doubleArray _chunkMaxDensityErrors;
+
+	//! Lattice sum of computeDelta(), cached for the parameter revision of
+	//! the particle data it was computed from.
+	double _deltaDenominator = 0.0;
+	unsigned int _deltaParameterRevision = 0;
+	const SphSystemData* _deltaParticles = nullptr;
+
+	//!
+	//! \brief Returns the PCISPH pressure scaling factor for the time step.
+	//!
+	//! Only the time step dependent beta is computed per call. The lattice
+	//! sum it is divided by is sampled again only when the SPH parameters
+	//! change.
+	//!
 	double computeDelta(double timeStepInSeconds);
 	double computeBeta(double timeStepInSeconds);
 };
@@ -1,4 +1,5 @@
 #include "PointHashGridSearcher.h"
+#include "Parallel.h"
 
 #include <algorithm>
 #include <cmath>
@@ -18,58 +19,77 @@ PointHashGridSearcher::PointHashGridSearcher(size_t resolutionX, size_t resoluti
 	_resolution.x = std::max(static_cast<size_t>(resolutionX), (size_t)1);
 	_resolution.y = std::max(static_cast<size_t>(resolutionY), (size_t)1);
 	_resolution.z = std::max(static_cast<size_t>(resolutionZ), (size_t)1);
+	_resolutionX = static_cast<size_t>(_resolution.x);
+	_resolutionY = static_cast<size_t>(_resolution.y);
+	_resolutionZ = static_cast<size_t>(_resolution.z);
+	_inverseGridSpacing = 1.0 / _gridspacing;
 }
 
+//! Large primes of the spatial hash by Teschner et al. 2003.
+static const uint64_t kHashPrimeX = 73856093;
+static const uint64_t kHashPrimeY = 19349663;
+static const uint64_t kHashPrimeZ = 83492791;
+
 void PointHashGridSearcher::build(std::vector<Vector3>& points)
 {
-	_buckets.clear();
-	_points.clear();
-
-	_buckets.resize(_resolution.x * _resolution.y * _resolution.z);
-	_points.resize(points.size());
+	_points.assign(points.begin(), points.end());
 
-	if (points.size() == 0)
+	if (_buildMode == BuildMode::Buckets)
 	{
+		_buckets.clear();
+		_buckets.resize(numberOfBuckets());
+
+		if (points.size() == 0)
+		{
+			return;
+		}
+
+		for (size_t i = 0; i < points.size(); ++i)
+		{
+			size_t key = getHashKeyFromPosition(points[i]);
+			_buckets[key].push_back(i);
+		}
 		return;
 	}
 
+	const size_t n = _points.size();
+	const size_t numberOfKeys = numberOfBuckets();
+	_pointKeys.resize(n);
+	_sortedIndices.resize(n);
+	_bucketStarts.assign(numberOfKeys + 1, 0);
 
-	for (size_t i = 0; i < points.size(); ++i)
+	// Pass 1: hash every point and count the bucket sizes.
+	parallelFor(0, n, [&](size_t i)
 	{
-		_points[i] = points[i];
-		size_t key = getHashKeyFromPosition(points[i]);
-		_buckets[key].push_back(i);
+		_pointKeys[i] = getHashKeyFromPosition(_points[i]);
+	});
+	for (size_t i = 0; i < n; ++i)
+	{
+		++_bucketStarts[_pointKeys[i]];
 	}
-}
 
-void PointHashGridSearcher::forEachNearbyPoint(Vector3 & origin, double radius, const ForEachNearbyPointFunc & callback)
-{
-	if (_buckets.empty())
+	// Inclusive prefix sum, _bucketStarts[k] now marks the end of bucket k.
+	for (size_t k = 1; k < numberOfKeys; ++k)
 	{
-		return;
+		_bucketStarts[k] += _bucketStarts[k - 1];
 	}
-	size_t nearbyKeys[8];
-	getNearbyKeys(origin, nearbyKeys);
-
-	const double queryRadiusSquared = radius * radius;
+	_bucketStarts[numberOfKeys] = n;
 
-	for (int i = 0; i < 8; i++)
+	// Pass 2: scatter backwards so every bucket lists its points in
+	// ascending order, the same order the Buckets layout gives.
+	for (size_t i = n; i-- > 0;)
 	{
-		const auto& bucket = _buckets[nearbyKeys[i]];
-		size_t numberOfPointsInBucket = bucket.size();
-
-		for (size_t j = 0; j < numberOfPointsInBucket; ++j)
-		{
-			size_t pointIndex = bucket[j];
-			double rSquared = (_points[pointIndex] - origin).lengthSquared();
-			if (rSquared <= queryRadiusSquared)
-			{
-				callback(pointIndex, _points[pointIndex]);
-			}
-		}
+		_sortedIndices[--_bucketStarts[_pointKeys[i]]] = i;
 	}
 }
 
+void PointHashGridSearcher::forEachNearbyPoint(const Vector3 & origin, double radius, const ForEachNearbyPointFunc & callback)
+{
+	// Explicit template argument, so this resolves to the inline version
+	// rather than back to this overload.
+	forEachNearbyPoint<ForEachNearbyPointFunc>(origin, radius, callback);
+}
+
 Vector3 PointHashGridSearcher::getBucketIndex(const Vector3 & position) const
 {
 	Vector3 bucketIndex;
@@ -79,8 +99,47 @@ Vector3 PointHashGridSearcher::getBucketIndex(const Vector3 & position) const
 	return bucketIndex;
 }
 
+static inline size_t wrapCellIndex(int64_t index, size_t resolution)
+{
+	int64_t wrapped = index % static_cast<int64_t>(resolution);
+	return static_cast<size_t>(
+		(wrapped < 0) ? wrapped + static_cast<int64_t>(resolution) : wrapped);
+}
+
+void PointHashGridSearcher::getCellIndex(const Vector3 & position, size_t * x, size_t * y, size_t * z) const
+{
+	*x = wrapCellIndex(static_cast<int64_t>(std::floor(position.x * _inverseGridSpacing)), _resolutionX);
+	*y = wrapCellIndex(static_cast<int64_t>(std::floor(position.y * _inverseGridSpacing)), _resolutionY);
+	*z = wrapCellIndex(static_cast<int64_t>(std::floor(position.z * _inverseGridSpacing)), _resolutionZ);
+}
+
+size_t PointHashGridSearcher::getHashKeyFromCell(int64_t x, int64_t y, int64_t z) const
+{
+	const uint64_t hash =
+		(static_cast<uint64_t>(x) * kHashPrimeX) ^
+		(static_cast<uint64_t>(y) * kHashPrimeY) ^
+		(static_cast<uint64_t>(z) * kHashPrimeZ);
+	// The table size is a power of two.
+	return static_cast<size_t>(hash & (_resolutionX - 1));
+}
+
 size_t PointHashGridSearcher::getHashKeyFromPosition(const Vector3 & position) const
 {
+	if (_searchMode == SearchMode::HashedStencil27)
+	{
+		return getHashKeyFromCell(
+			static_cast<int64_t>(std::floor(position.x * _inverseGridSpacing)),
+			static_cast<int64_t>(std::floor(position.y * _inverseGridSpacing)),
+			static_cast<int64_t>(std::floor(position.z * _inverseGridSpacing)));
+	}
+
+	if (_searchMode == SearchMode::Stencil27)
+	{
+		size_t x, y, z;
+		getCellIndex(position, &x, &y, &z);
+		return (z * _resolutionY + y) * _resolutionX + x;
+	}
+
 	Vector3 bucketIndex = getBucketIndex(position);
 	return getHashKeyFromBucketIndex(bucketIndex);
 }
@@ -98,8 +157,70 @@ size_t PointHashGridSearcher::getHashKeyFromBucketIndex(const Vector3 & bucketIn
 		(wrappedIndex.z * _resolution.y + wrappedIndex.y)*_resolution.x + wrappedIndex.x);
 }
 
-void PointHashGridSearcher::getNearbyKeys(const Vector3 & positon, size_t * nearbyKeys) const
+size_t PointHashGridSearcher::getNearbyKeys(const Vector3 & positon, size_t * nearbyKeys) const
 {
+	if (_searchMode == SearchMode::HashedStencil27)
+	{
+		const int64_t x = static_cast<int64_t>(std::floor(positon.x * _inverseGridSpacing));
+		const int64_t y = static_cast<int64_t>(std::floor(positon.y * _inverseGridSpacing));
+		const int64_t z = static_cast<int64_t>(std::floor(positon.z * _inverseGridSpacing));
+
+		// Different cells can hash to the same key, skip repeated keys so
+		// no bucket is visited twice.
+		size_t numberOfKeys = 0;
+		for (int64_t dz = -1; dz <= 1; dz++)
+		{
+			for (int64_t dy = -1; dy <= 1; dy++)
+			{
+				for (int64_t dx = -1; dx <= 1; dx++)
+				{
+					const size_t key = getHashKeyFromCell(x + dx, y + dy, z + dz);
+					if (std::find(nearbyKeys, nearbyKeys + numberOfKeys, key) == nearbyKeys + numberOfKeys)
+					{
+						nearbyKeys[numberOfKeys++] = key;
+					}
+				}
+			}
+		}
+		return numberOfKeys;
+	}
+
+	if (_searchMode == SearchMode::Stencil27)
+	{
+		size_t x, y, z;
+		getCellIndex(positon, &x, &y, &z);
+		const size_t centreKey = (z * _resolutionY + y) * _resolutionX + x;
+
+		if (x > 0 && x + 1 < _resolutionX &&
+			y > 0 && y + 1 < _resolutionY &&
+			z > 0 && z + 1 < _resolutionZ)
+		{
+			for (int i = 0; i < 27; i++)
+			{
+				nearbyKeys[i] = static_cast<size_t>(
+					static_cast<std::ptrdiff_t>(centreKey) + _stencilKeyOffsets[i]);
+			}
+			return 27;
+		}
+
+		// Cells on the boundary wrap around to the opposite side.
+		const size_t xs[3] = { (x == 0) ? _resolutionX - 1 : x - 1, x, (x + 1 == _resolutionX) ? 0 : x + 1 };
+		const size_t ys[3] = { (y == 0) ? _resolutionY - 1 : y - 1, y, (y + 1 == _resolutionY) ? 0 : y + 1 };
+		const size_t zs[3] = { (z == 0) ? _resolutionZ - 1 : z - 1, z, (z + 1 == _resolutionZ) ? 0 : z + 1 };
+		int i = 0;
+		for (int dz = 0; dz < 3; dz++)
+		{
+			for (int dy = 0; dy < 3; dy++)
+			{
+				for (int dx = 0; dx < 3; dx++)
+				{
+					nearbyKeys[i++] = (zs[dz] * _resolutionY + ys[dy]) * _resolutionX + xs[dx];
+				}
+			}
+		}
+		return 27;
+	}
+
 	Vector3 originIndex = getBucketIndex(positon), nearbyBucketIndices[8];
 	for (int i = 0; i < 8; i++)
 	{
@@ -141,33 +262,31 @@ void PointHashGridSearcher::getNearbyKeys(const Vector3 & positon, size_t * near
 	{
 		nearbyKeys[i] = getHashKeyFromBucketIndex(nearbyBucketIndices[i]);
 	}
+	return 8;
 }
 
 bool PointHashGridSearcher::hasNearbyPoint(const Vector3 & origin, double radius)
 {
-	if (_buckets.empty()) 
+	if (!isBuilt()) 
 	{
 		return false;
 	}
 
-	size_t nearbyKeys[8];
-	getNearbyKeys(origin, nearbyKeys);
+	size_t nearbyKeys[27];
+	const size_t numberOfNearbyKeys = getNearbyKeys(origin, nearbyKeys);
 
 	const double queryRadiusSquared = radius * radius;
 
-	for (int i = 0; i < 8; i++)
+	for (size_t i = 0; i < numberOfNearbyKeys; i++)
 	{
-		const auto& bucket = _buckets[nearbyKeys[i]];
-		size_t numberOfPointsInBucket = bucket.size();
-
-		for (size_t j = 0; j < numberOfPointsInBucket; ++j) 
+		bool hasNoPointWithinRadius = forEachPointInBucket(nearbyKeys[i], [&](size_t pointIndex)
 		{
-			size_t pointIndex = bucket[j];
 			double rSquared = (_points[pointIndex] - origin).lengthSquared();
-			if (rSquared <= queryRadiusSquared) 
-			{
-				return true;
-			}
+			return rSquared > queryRadiusSquared;
+		});
+		if (!hasNoPointWithinRadius)
+		{
+			return true;
 		}
 	}
 
@@ -176,16 +295,142 @@ bool PointHashGridSearcher::hasNearbyPoint(const Vector3 & origin, double radius
 
 void PointHashGridSearcher::add(const Vector3 & point)
 {
-	if (_buckets.empty()) 
+	if (!isBuilt()) 
 	{
 		std::vector<Vector3> arr = { point };
 		build(arr);
 	}
-	else
+	else if (_buildMode == BuildMode::Buckets)
 	{
 		size_t i = _points.size();
 		_points.push_back(point);
 		size_t key = getHashKeyFromPosition(point);
 		_buckets[key].push_back(i);
 	}
+	else
+	{
+		std::vector<Vector3> arr = _points;
+		arr.push_back(point);
+		build(arr);
+	}
+}
+
+PointHashGridSearcher::BuildMode PointHashGridSearcher::buildMode() const
+{
+	return _buildMode;
+}
+
+void PointHashGridSearcher::setBuildMode(BuildMode buildMode)
+{
+	if (_buildMode != buildMode)
+	{
+		// Drop the old layout, the searcher has to be rebuilt in the new one.
+		_buildMode = buildMode;
+		clearLayout();
+	}
+}
+
+PointHashGridSearcher::SearchMode PointHashGridSearcher::searchMode() const
+{
+	return _searchMode;
+}
+
+void PointHashGridSearcher::setSearchMode(SearchMode searchMode)
+{
+	_searchMode = searchMode;
+	updateIntegerGrid();
+
+	// Bucket keys depend on the mode, drop the old layout.
+	clearLayout();
+}
+
+void PointHashGridSearcher::resize(size_t resolutionX, size_t resolutionY, size_t resolutionZ, double gridSpacing)
+{
+	const size_t oldResolutionX = _resolutionX;
+	const size_t oldResolutionY = _resolutionY;
+	const size_t oldResolutionZ = _resolutionZ;
+	const double oldGridSpacing = _gridspacing;
+
+	_gridspacing = gridSpacing;
+	_inverseGridSpacing = 1.0 / _gridspacing;
+	_resolutionX = std::max(resolutionX, (size_t)1);
+	_resolutionY = std::max(resolutionY, (size_t)1);
+	_resolutionZ = std::max(resolutionZ, (size_t)1);
+	updateIntegerGrid();
+
+	if (_resolutionX != oldResolutionX ||
+		_resolutionY != oldResolutionY ||
+		_resolutionZ != oldResolutionZ ||
+		_gridspacing != oldGridSpacing)
+	{
+		clearLayout();
+	}
+}
+
+Vector3 PointHashGridSearcher::resolution() const
+{
+	return _resolution;
+}
+
+double PointHashGridSearcher::gridSpacing() const
+{
+	return _gridspacing;
+}
+
+void PointHashGridSearcher::updateIntegerGrid()
+{
+	if (_searchMode == SearchMode::HashedStencil27)
+	{
+		size_t tableSize = 1;
+		while (tableSize < _resolutionX * _resolutionY * _resolutionZ)
+		{
+			tableSize <<= 1;
+		}
+		_resolutionX = tableSize;
+		_resolutionY = 1;
+		_resolutionZ = 1;
+	}
+	else if (_searchMode == SearchMode::Stencil27)
+	{
+		_resolutionX = std::max(_resolutionX, (size_t)3);
+		_resolutionY = std::max(_resolutionY, (size_t)3);
+		_resolutionZ = std::max(_resolutionZ, (size_t)3);
+
+		int i = 0;
+		for (std::ptrdiff_t dz = -1; dz <= 1; dz++)
+		{
+			for (std::ptrdiff_t dy = -1; dy <= 1; dy++)
+			{
+				for (std::ptrdiff_t dx = -1; dx <= 1; dx++)
+				{
+					_stencilKeyOffsets[i++] =
+						(dz * static_cast<std::ptrdiff_t>(_resolutionY) + dy) *
+						static_cast<std::ptrdiff_t>(_resolutionX) + dx;
+				}
+			}
+		}
+	}
+
+	_resolution = Vector3(
+		static_cast<double>(_resolutionX),
+		static_cast<double>(_resolutionY),
+		static_cast<double>(_resolutionZ));
+}
+
+void PointHashGridSearcher::clearLayout()
+{
+	_buckets.clear();
+	_bucketStarts.clear();
+	_sortedIndices.clear();
+	_points.clear();
+}
+
+bool PointHashGridSearcher::isBuilt() const
+{
+	return (_buildMode == BuildMode::Buckets) ? !_buckets.empty() : !_bucketStarts.empty();
+}
+
+size_t PointHashGridSearcher::numberOfBuckets() const
+{
+	return static_cast<size_t>(_resolution.x * _resolution.y * _resolution.z);
 }
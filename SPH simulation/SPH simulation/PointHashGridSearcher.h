@@ -2,6 +2,7 @@
 #ifndef INCLUDE_POINT_HASH_GRID_SEARCHER_H_
 #define INCLUDE_POINT_HASH_GRID_SEARCHER_H_
 
+#include <cstdint>
 #include <vector>
 
 #include "PointNeighbourSearcher.h"
@@ -9,6 +10,35 @@
 class PointHashGridSearcher final : public PointNeighbourSearcher
 {
 public:
+	//! Memory layout build() produces for the buckets.
+	enum class BuildMode
+	{
+		//! One index vector per bucket. Cheap incremental add().
+		Buckets,
+
+		//! Counting sort into one flat index array with per-bucket start
+		//! offsets. No per-bucket allocations when rebuilt every substep.
+		CountingSort
+	};
+
+	//! Which buckets a query visits.
+	enum class SearchMode
+	{
+		//! The 8 buckets around the octant the query point lies in. Needs a
+		//! grid spacing of twice the search radius.
+		Octant8,
+
+		//! The 27 buckets around the query point's cell, with integer cell
+		//! keys. Needs a grid spacing equal to the search radius.
+		Stencil27,
+
+		//! Like Stencil27, but the unbounded integer cells are hashed into a
+		//! table instead of wrapped into a dense grid. For domains too large
+		//! for a dense grid. The table size is the product of the resolution,
+		//! rounded up to a power of two.
+		HashedStencil27
+	};
+
 	PointHashGridSearcher(const Vector3 resolution, double gridSpacing);
 	PointHashGridSearcher(
 		size_t resolutionX,
@@ -19,10 +49,24 @@ public:
 	void build(std::vector<Vector3>& points) override;
 
 	void forEachNearbyPoint(
-		Vector3& origin,
+		const Vector3& origin,
 		double radius,
 		const ForEachNearbyPointFunc& callback) override;
 
+	//!
+	//! \brief Inlinable version of forEachNearbyPoint().
+	//!
+	//! \p callback is called as callback(pointIndex, position) and can be any
+	//! callable, so hot loops that hold the concrete searcher avoid the
+	//! std::function call per visited point. Overload resolution picks this
+	//! version whenever a lambda is passed directly.
+	//!
+	template <typename Callback>
+	void forEachNearbyPoint(
+		const Vector3& origin,
+		double radius,
+		const Callback& callback);
+
 	Vector3 getBucketIndex(const Vector3& position) const;
 
 
@@ -32,17 +76,162 @@ public:
 	bool hasNearbyPoint(
 		const Vector3& origin, double radius) override;
 
+	//!
+	//! \brief Adds a single point to the searcher.
+	//!
+	//! In CountingSort mode this rebuilds the sorted layout, so searchers that
+	//! grow one point at a time should use BuildMode::Buckets.
+	//!
 	void add(const Vector3& point);
 
+	//! Returns the bucket layout used by build().
+	BuildMode buildMode() const;
+
+	//! Sets the bucket layout used by the next build(). Default is CountingSort.
+	void setBuildMode(BuildMode buildMode);
+
+	//! Returns which buckets a query visits.
+	SearchMode searchMode() const;
+
+	//!
+	//! \brief Sets which buckets a query visits. Default is Octant8.
+	//!
+	//! The grid spacing has to match the mode, see SearchMode. Stencil27
+	//! raises every resolution to at least 3 so the stencil never visits a
+	//! bucket twice. The searcher has to be rebuilt afterwards.
+	//!
+	void setSearchMode(SearchMode searchMode);
+
+	//!
+	//! \brief Changes the resolution and grid spacing in place.
+	//!
+	//! Lets a searcher be reused when the grid changes. Does nothing if both
+	//! are unchanged, otherwise the searcher has to be rebuilt afterwards.
+	//!
+	void resize(
+		size_t resolutionX,
+		size_t resolutionY,
+		size_t resolutionZ,
+		double gridSpacing);
+
+	//! Returns the grid resolution.
+	Vector3 resolution() const;
+
+	//! Returns the grid spacing.
+	double gridSpacing() const;
+
 private:
 	double _gridspacing = 1.0;
 	Vector3 _resolution = Vector3(1, 1, 1);
 	std::vector<Vector3> _points;
+	BuildMode _buildMode = BuildMode::CountingSort;
+	SearchMode _searchMode = SearchMode::Octant8;
+
+	//! Integer grid used by Stencil27 and HashedStencil27.
+	double _inverseGridSpacing = 1.0;
+	size_t _resolutionX = 1;
+	size_t _resolutionY = 1;
+	size_t _resolutionZ = 1;
+
+	//! Key offsets of the 27 stencil cells from the centre cell, valid when
+	//! the centre is not on the wrap-around boundary.
+	std::ptrdiff_t _stencilKeyOffsets[27];
+
+	//! Buckets layout.
 	std::vector< std::vector<size_t>> _buckets;
 
+	//! CountingSort layout. Bucket k holds
+	//! _sortedIndices[_bucketStarts[k]] .. _sortedIndices[_bucketStarts[k + 1] - 1].
+	std::vector<size_t> _bucketStarts;
+	std::vector<size_t> _sortedIndices;
+	std::vector<size_t> _pointKeys;
+
+	bool isBuilt() const;
+
+	//! Applies the resolution constraints of the search mode and updates
+	//! the stencil key offsets.
+	void updateIntegerGrid();
+
+	//! Drops the current bucket layout.
+	void clearLayout();
+
+	size_t numberOfBuckets() const;
+
+	//! Calls \p func(pointIndex) for each point in bucket \p key until it
+	//! returns false. Returns false if the iteration was stopped.
+	template <typename Function>
+	bool forEachPointInBucket(size_t key, const Function& func) const;
+
+	//! Returns the wrapped integer cell of \p position for Stencil27.
+	void getCellIndex(const Vector3& position, size_t* x, size_t* y, size_t* z) const;
+
+	//! Returns the hash table key of the integer cell (x, y, z) for
+	//! HashedStencil27.
+	size_t getHashKeyFromCell(int64_t x, int64_t y, int64_t z) const;
+
 	size_t getHashKeyFromPosition(const Vector3& position) const;
-	void getNearbyKeys(const Vector3& positon, size_t* nearbyKeys) const;
+
+	//! Writes the keys of the buckets a query at \p positon visits and
+	//! returns how many there are (8 or 27).
+	size_t getNearbyKeys(const Vector3& positon, size_t* nearbyKeys) const;
 };
 
+template <typename Callback>
+inline void PointHashGridSearcher::forEachNearbyPoint(
+	const Vector3& origin,
+	double radius,
+	const Callback& callback)
+{
+	if (!isBuilt())
+	{
+		return;
+	}
+	size_t nearbyKeys[27];
+	const size_t numberOfNearbyKeys = getNearbyKeys(origin, nearbyKeys);
+
+	const double queryRadiusSquared = radius * radius;
+
+	for (size_t i = 0; i < numberOfNearbyKeys; i++)
+	{
+		forEachPointInBucket(nearbyKeys[i], [&](size_t pointIndex)
+		{
+			const Vector3& point = _points[pointIndex];
+			double rSquared = (point - origin).lengthSquared();
+			if (rSquared <= queryRadiusSquared)
+			{
+				callback(pointIndex, point);
+			}
+			return true;
+		});
+	}
+}
+
+template <typename Function>
+inline bool PointHashGridSearcher::forEachPointInBucket(size_t key, const Function& func) const
+{
+	if (_buildMode == BuildMode::CountingSort)
+	{
+		const size_t end = _bucketStarts[key + 1];
+		for (size_t k = _bucketStarts[key]; k < end; ++k)
+		{
+			if (!func(_sortedIndices[k]))
+			{
+				return false;
+			}
+		}
+	}
+	else
+	{
+		for (size_t pointIndex : _buckets[key])
+		{
+			if (!func(pointIndex))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
 typedef std::shared_ptr<PointHashGridSearcher> PointHashGridSearcherPtr;
 #endif
\ No newline at end of file
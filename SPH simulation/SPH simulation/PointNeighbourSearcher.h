@@ -18,7 +18,7 @@ public:
 	virtual void build(std::vector<Vector3>& points) = 0;
 
 	virtual void forEachNearbyPoint(
-		Vector3& origin,
+		const Vector3& origin,
 		double radius,
 		const ForEachNearbyPointFunc& callback) = 0;
 
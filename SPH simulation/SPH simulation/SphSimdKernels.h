@@ -0,0 +1,54 @@
+#pragma once
+#ifndef INCLUDE_SPH_SIMD_KERNELS_H_
+#define INCLUDE_SPH_SIMD_KERNELS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "SphStdKernel.h"
+#include "Vector3.h"
+
+//
+// The loops below walk a CSR neighbour list in blocks of kKernelBatchSize.
+// Each block first gathers the squared distances into a small contiguous
+// array and then evaluates the kernel over it with the batch entry points of
+// SphStdKernel, which compilers turn into vector code.
+//
+
+//! Neighbours gathered per block by the batched loops.
+const size_t kKernelBatchSize = 32;
+
+//!
+//! \brief Returns the SphStdKernel sum around particle \p i.
+//!
+//! Includes the particle itself, so mass times the result is the density.
+//! The std kernel only needs r^2, so there is no square root.
+//!
+inline double sumStdKernelAt(
+	const std::vector<Vector3>& positions,
+	size_t i,
+	const uint32_t* neighbours,
+	size_t numberOfNeighbours,
+	const SphStdKernel& kernel)
+{
+	const Vector3& origin = positions[i];
+	double total = kernel.weightCoefficient;
+	for (size_t begin = 0; begin < numberOfNeighbours; begin += kKernelBatchSize)
+	{
+		const size_t count = std::min(kKernelBatchSize, numberOfNeighbours - begin);
+		double r2[kKernelBatchSize], w[kKernelBatchSize];
+		for (size_t l = 0; l < count; ++l)
+		{
+			r2[l] = (positions[neighbours[begin + l]] - origin).lengthSquared();
+		}
+		kernel.weights(r2, count, w);
+		for (size_t l = 0; l < count; ++l)
+		{
+			total += w[l];
+		}
+	}
+	return total;
+}
+
+#endif
@@ -2,11 +2,19 @@
 #ifndef INCLUDE_SPHSPIKYKERNEL_H_
 #define INCLUDE_SPHSPIKYKERNEL_H_
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
 #include "Vector3.h"
 
 struct SphSpikyKernel
 {
 	double h, h2, h3, h4, h5;
+
+	//! 1 / h and the coefficients with the powers of h folded in.
+	double invH, valueCoefficient, firstDerivativeCoefficient, secondDerivativeCoefficient;
+
 	SphSpikyKernel();
 
 	explicit SphSpikyKernel(double kernelRadius);
@@ -19,14 +27,40 @@ struct SphSpikyKernel
 
 	double secondDerivative(double distance) const;
 
+	//!
+	//! \brief Writes operator()(r) for \p n squared distances r^2 to \p values.
+	//!
+	//! Branch-free, so the loop vectorises. The spiky kernel is a polynomial
+	//! in r, so each entry takes one square root.
+	//!
+	template <typename Real>
+	void values(const Real* distancesSquared, size_t n, Real* values) const;
+
+	//! Writes firstDerivative(r) for \p n squared distances to \p derivatives.
+	template <typename Real>
+	void firstDerivatives(const Real* distancesSquared, size_t n, Real* derivatives) const;
+
+	//! Writes secondDerivative(r) for \p n squared distances to \p derivatives.
+	template <typename Real>
+	void secondDerivatives(const Real* distancesSquared, size_t n, Real* derivatives) const;
+
 	const double kPiD = 3.14159265358979323846264338327950288;
+
+	//! 15 / pi, 45 / pi and 90 / pi, folded at compile time.
+	static constexpr double kValueFactor = 15.0 / 3.14159265358979323846264338327950288;
+	static constexpr double kFirstDerivativeFactor = 45.0 / 3.14159265358979323846264338327950288;
+	static constexpr double kSecondDerivativeFactor = 90.0 / 3.14159265358979323846264338327950288;
 };
 
 inline SphSpikyKernel::SphSpikyKernel()
-	: h(0), h2(0), h3(0), h4(0), h5(0){}
+	: h(0), h2(0), h3(0), h4(0), h5(0),
+	invH(0), valueCoefficient(0), firstDerivativeCoefficient(0), secondDerivativeCoefficient(0) {}
 
 inline SphSpikyKernel::SphSpikyKernel(double h_)
-	: h(h_), h2(h*h), h3(h2*h), h4(h2*h2), h5(h3*h2) {}
+	: h(h_), h2(h*h), h3(h2*h), h4(h2*h2), h5(h3*h2),
+	invH(1.0 / h), valueCoefficient(kValueFactor / h3),
+	firstDerivativeCoefficient(kFirstDerivativeFactor / h4),
+	secondDerivativeCoefficient(kSecondDerivativeFactor / h5) {}
 
 inline double SphSpikyKernel::operator()(double distance) const
 {
@@ -36,8 +70,8 @@ inline double SphSpikyKernel::operator()(double distance) const
 	}
 	else
 	{
-		double x = 1.0 - distance / h;
-		return 15.0 / (kPiD*h3)*x*x*x;
+		double x = 1.0 - distance * invH;
+		return valueCoefficient*x*x*x;
 	}
 }
 
@@ -49,8 +83,8 @@ inline double SphSpikyKernel::firstDerivative(double distance) const
 	}
 	else
 	{
-		double x = 1.0 - distance / h;
-		return -45.0 / (kPiD*h4)*x*x;
+		double x = 1.0 - distance * invH;
+		return -firstDerivativeCoefficient*x*x;
 	}
 }
 
@@ -67,8 +101,45 @@ inline double SphSpikyKernel::secondDerivative(double distance) const
 	}
 	else
 	{
-		double x = 1.0 - distance / h;
-		return 90.0 / (kPiD*h5)*x;
+		double x = 1.0 - distance * invH;
+		return secondDerivativeCoefficient*x;
+	}
+}
+
+template <typename Real>
+inline void SphSpikyKernel::values(const Real* distancesSquared, size_t n, Real* values) const
+{
+	const Real invHReal = static_cast<Real>(invH);
+	const Real coefficient = static_cast<Real>(valueCoefficient);
+	for (size_t i = 0; i < n; ++i)
+	{
+		// Clamping 1 - r/h at zero replaces the r >= h branch.
+		const Real x = std::max(Real(1) - std::sqrt(distancesSquared[i]) * invHReal, Real(0));
+		values[i] = coefficient * x * x * x;
+	}
+}
+
+template <typename Real>
+inline void SphSpikyKernel::firstDerivatives(const Real* distancesSquared, size_t n, Real* derivatives) const
+{
+	const Real invHReal = static_cast<Real>(invH);
+	const Real coefficient = static_cast<Real>(-firstDerivativeCoefficient);
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Real x = std::max(Real(1) - std::sqrt(distancesSquared[i]) * invHReal, Real(0));
+		derivatives[i] = coefficient * x * x;
+	}
+}
+
+template <typename Real>
+inline void SphSpikyKernel::secondDerivatives(const Real* distancesSquared, size_t n, Real* derivatives) const
+{
+	const Real invHReal = static_cast<Real>(invH);
+	const Real coefficient = static_cast<Real>(secondDerivativeCoefficient);
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Real x = std::max(Real(1) - std::sqrt(distancesSquared[i]) * invHReal, Real(0));
+		derivatives[i] = coefficient * x;
 	}
 }
-#endif
\ No newline at end of file
+#endif
@@ -2,10 +2,19 @@
 #ifndef INCLUDE_SPHSTDKERNEL_H_
 #define INCLUDE_SPHSTDKERNEL_H_
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include "Vector3.h"
+
 struct SphStdKernel
 {
 	double h, h2, h3, h5;
 
+	//! 1 / h^2 and the coefficients with the powers of h folded in.
+	double invH2, weightCoefficient, derivativeCoefficient;
+
 	SphStdKernel();
 
 	explicit SphStdKernel(double kernelRadius);
@@ -18,12 +27,35 @@ struct SphStdKernel
 
 	double secondDerivative(double distance) const;
 
+	//!
+	//! \brief Writes operator()(r) for \p n squared distances r^2 to \p weights.
+	//!
+	//! Branch-free and without square roots, so the loop vectorises.
+	//!
+	template <typename Real>
+	void weights(const Real* distancesSquared, size_t n, Real* weights) const;
+
+	//! Writes firstDerivative(r) for \p n squared distances to \p derivatives.
+	template <typename Real>
+	void firstDerivatives(const Real* distancesSquared, size_t n, Real* derivatives) const;
+
+	//! Writes secondDerivative(r) for \p n squared distances to \p derivatives.
+	template <typename Real>
+	void secondDerivatives(const Real* distancesSquared, size_t n, Real* derivatives) const;
+
 	const double kPiD = 3.14159265358979323846264338327950288;
+
+	//! 315 / (64 pi) and 945 / (32 pi), folded at compile time.
+	static constexpr double kWeightFactor = 315.0 / (64.0 * 3.14159265358979323846264338327950288);
+	static constexpr double kDerivativeFactor = 945.0 / (32.0 * 3.14159265358979323846264338327950288);
 };
 
-inline SphStdKernel::SphStdKernel() : h(0),h2(0),h3(0){}
+inline SphStdKernel::SphStdKernel()
+	: h(0), h2(0), h3(0), h5(0), invH2(0), weightCoefficient(0), derivativeCoefficient(0) {}
 
-inline SphStdKernel::SphStdKernel(double kernelRadius) : h(kernelRadius), h2(h*h), h3(h2*h), h5(h2*h3) {}
+inline SphStdKernel::SphStdKernel(double kernelRadius)
+	: h(kernelRadius), h2(h*h), h3(h2*h), h5(h2*h3),
+	invH2(1.0 / h2), weightCoefficient(kWeightFactor / h3), derivativeCoefficient(kDerivativeFactor / h5) {}
 
 inline double SphStdKernel::operator()(double distance) const
 {
@@ -33,8 +65,8 @@ inline double SphStdKernel::operator()(double distance) const
 	}
 	else
 	{
-		double x = 1.0 - (distance * distance) / h2;
-		return 315.0 / (64.0 * kPiD * h3) * x * x * x;
+		double x = 1.0 - (distance * distance) * invH2;
+		return weightCoefficient * x * x * x;
 	}
 }
 
@@ -46,8 +78,8 @@ inline double SphStdKernel::firstDerivative(double distance) const
 	}
 	else
 	{
-		double x = 1.0 - (distance * distance) / h2;
-		return -945.0 / (32.0*kPiD * h5) * distance * x* x;
+		double x = 1.0 - (distance * distance) * invH2;
+		return -derivativeCoefficient * distance * x* x;
 	}
 }
 inline Vector3 SphStdKernel::gradient(double distance, Vector3& direction) const
@@ -63,8 +95,47 @@ inline double SphStdKernel::secondDerivative(double distance) const
 	}
 	else
 	{
-		double x = distance * distance / h2;
-		return 945.0 / (32.0*kPiD*h5)* (1 - x) * (3 * x - 1);
+		double x = distance * distance * invH2;
+		return derivativeCoefficient * (1 - x) * (3 * x - 1);
+	}
+}
+
+template <typename Real>
+inline void SphStdKernel::weights(const Real* distancesSquared, size_t n, Real* weights) const
+{
+	const Real invH2Real = static_cast<Real>(invH2);
+	const Real coefficient = static_cast<Real>(weightCoefficient);
+	for (size_t i = 0; i < n; ++i)
+	{
+		// Clamping 1 - r^2/h^2 at zero replaces the r >= h branch.
+		const Real x = std::max(Real(1) - distancesSquared[i] * invH2Real, Real(0));
+		weights[i] = coefficient * x * x * x;
+	}
+}
+
+template <typename Real>
+inline void SphStdKernel::firstDerivatives(const Real* distancesSquared, size_t n, Real* derivatives) const
+{
+	const Real invH2Real = static_cast<Real>(invH2);
+	const Real coefficient = static_cast<Real>(-derivativeCoefficient);
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Real x = std::max(Real(1) - distancesSquared[i] * invH2Real, Real(0));
+		derivatives[i] = coefficient * std::sqrt(distancesSquared[i]) * x * x;
+	}
+}
+
+template <typename Real>
+inline void SphStdKernel::secondDerivatives(const Real* distancesSquared, size_t n, Real* derivatives) const
+{
+	const Real invH2Real = static_cast<Real>(invH2);
+	const Real coefficient = static_cast<Real>(derivativeCoefficient);
+	for (size_t i = 0; i < n; ++i)
+	{
+		// With y = max(1 - r^2/h^2, 0), (1 - x)(3x - 1) is y (2 - 3y) and
+		// vanishes outside the support.
+		const Real y = std::max(Real(1) - distancesSquared[i] * invH2Real, Real(0));
+		derivatives[i] = coefficient * y * (Real(2) - Real(3) * y);
 	}
 }
-#endif
\ No newline at end of file
+#endif
@@ -1,4 +1,6 @@
 #include "SphSystemData.h"
+#include "Parallel.h"
+#include "SphSimdKernels.h"
 
 #include <algorithm>
 
@@ -33,9 +35,20 @@ std::vector<double>& SphSystemData::pressures()
 	return scalarDataAt(_pressureIdx);
 }
 
+const std::vector<double>& SphSystemData::densities() const
+{
+	return scalarDataAt(_densityIdx);
+}
+
+const std::vector<double>& SphSystemData::pressures() const
+{
+	return scalarDataAt(_pressureIdx);
+}
+
 void SphSystemData::setTargetDensity(double targetDensity)
 {
 	_targetDensity = targetDensity;
+	++_parameterRevision;
 
 	computeMass();
 }
@@ -51,6 +64,7 @@ void SphSystemData::setTargetSpacing(double spacing)
 
 	_targetSpacing = spacing;
 	_kernelRadius = _kernelRadiusOverTargetSpacing * _targetSpacing;
+	++_parameterRevision;
 
 	computeMass();
 }
@@ -64,6 +78,7 @@ void SphSystemData::setRelativeKernelRadius(double relativeRadius)
 {
 	_kernelRadiusOverTargetSpacing = relativeRadius;
 	_kernelRadius = _kernelRadiusOverTargetSpacing * _targetSpacing;
+	++_parameterRevision;
 
 	computeMass();
 }
@@ -72,12 +87,46 @@ void SphSystemData::setKernelRadius(double kernelRadius)
 {
 	_kernelRadius = kernelRadius;
 	_targetSpacing = kernelRadius / _kernelRadiusOverTargetSpacing;
+	++_parameterRevision;
 
 	computeMass();
 }
 
 void SphSystemData::updateDensities()
 {
+	if (isUsingPairCache())
+	{
+		// The lists leave out the particle itself, add its kernel(0) term.
+		const auto& offsets = neighbourOffsets();
+		const auto& distances = pairDistances();
+		auto& d = densities();
+		const double m = mass();
+		SphStdKernel kernel(_kernelRadius);
+		const double selfWeight = kernel(0.0);
+
+		d.resize(numberOfParticles());
+		parallelFor(0, numberOfParticles(), [&](size_t i)
+		{
+			double sum = selfWeight;
+			for (size_t begin = offsets[i]; begin < offsets[i + 1]; begin += kKernelBatchSize)
+			{
+				const size_t count = std::min(kKernelBatchSize, offsets[i + 1] - begin);
+				double r2[kKernelBatchSize], w[kKernelBatchSize];
+				for (size_t l = 0; l < count; ++l)
+				{
+					r2[l] = distances[begin + l] * distances[begin + l];
+				}
+				kernel.weights(r2, count, w);
+				for (size_t l = 0; l < count; ++l)
+				{
+					sum += w[l];
+				}
+			}
+			d[i] = m * sum;
+		});
+		return;
+	}
+
 	for (size_t i = 0; i < numberOfParticles(); i++)
 	{
 		double sum = sumOfKernelNearby(positions()[i]);
@@ -92,12 +141,12 @@ void SphSystemData::updateDensities()
 	}
 }
 
-double SphSystemData::sumOfKernelNearby(Vector3 & pos)
+double SphSystemData::sumOfKernelNearby(const Vector3 & pos)
 {
 	double sum = 0.0;
 
 	SphStdKernel kernel(_kernelRadius);
-	neighborSearcher()->forEachNearbyPoint(
+	hashGridSearcher()->forEachNearbyPoint(
 		pos,
 		_kernelRadius,
 		[&](size_t, const Vector3& neighbourPosition)
@@ -109,16 +158,16 @@ double SphSystemData::sumOfKernelNearby(Vector3 & pos)
 }
 
 Vector3 SphSystemData::interpolate(
-	Vector3& origin,
-	std::vector<Vector3>& values)
+	const Vector3& origin,
+	const std::vector<Vector3>& values)
 {
 	Vector3 sum;
-	auto d = densities();
+	const auto& d = densities();
 
 	SphStdKernel kernel(_kernelRadius);
 	double m = mass();
 
-	neighborSearcher()->forEachNearbyPoint(
+	hashGridSearcher()->forEachNearbyPoint(
 		origin,
 		_kernelRadius,
 		[&](size_t i, const Vector3& neighbourPosition)
@@ -131,15 +180,14 @@ Vector3 SphSystemData::interpolate(
 }
 
 double SphSystemData::interpolate(
-	Vector3& origin)
+	const Vector3& origin)
 {
-	double sum;
-	auto d = densities();
+	double sum = 0.0;
 
 	SphStdKernel kernel(_kernelRadius);
 	double m = mass();
 
-	neighborSearcher()->forEachNearbyPoint(
+	hashGridSearcher()->forEachNearbyPoint(
 		origin,
 		_kernelRadius,
 		[&](size_t i, const Vector3& neighbourPosition)
@@ -151,18 +199,37 @@ double SphSystemData::interpolate(
 	return sum;
 }
 
-Vector3 SphSystemData::gradientAt(size_t i, const std::vector<double>& values)
+Vector3 SphSystemData::gradientAt(size_t i, const std::vector<double>& values) const
 {
 	Vector3 sum;
-	auto p = positions();
-	auto d = densities();
-	const auto& neighbours = neighborLists()[i];
-	Vector3 origin = p.at(i);
+	const auto& p = positions();
+	const auto& d = densities();
+	const auto& offsets = neighbourOffsets();
+	const auto& indices = neighbourIndices();
+	const Vector3& origin = p.at(i);
 	SphSpikyKernel kernel(_kernelRadius);
 
-	for (size_t j : neighbours)
+	if (isUsingPairCache())
 	{
-		Vector3 neighbourPosition = p.at(j);
+		const auto& distances = pairDistances();
+		const auto& directions = pairDirections();
+		for (size_t k = offsets[i]; k < offsets[i + 1]; ++k)
+		{
+			size_t j = indices[k];
+			if (distances[k] > 0.0)
+			{
+				Vector3 dir = directions[k];
+				sum += kernel.gradient(distances[k], dir) * (d[i] * mass() *
+					(values[i] / (d[i] * d[i]) + values[j] / (d[j] * d[j])));
+			}
+		}
+		return sum;
+	}
+
+	for (size_t k = offsets[i]; k < offsets[i + 1]; ++k)
+	{
+		size_t j = indices[k];
+		const Vector3& neighbourPosition = p.at(j);
 		double dist = origin.distanceTo(neighbourPosition);
 		if (dist > 0.0)
 		{
@@ -174,18 +241,31 @@ Vector3 SphSystemData::gradientAt(size_t i, const std::vector<double>& values)
 	return sum;
 }
 
-double SphSystemData::laplacianAt(size_t i, const std::vector<double>& values)
+double SphSystemData::laplacianAt(size_t i, const std::vector<double>& values) const
 {
 	double sum = 0.0;
-	auto p = positions();
-	auto d = densities();
-	const auto& neightbours = neighborLists()[i];
-	Vector3& origin = p.at(i);
+	const auto& p = positions();
+	const auto& d = densities();
+	const auto& offsets = neighbourOffsets();
+	const auto& indices = neighbourIndices();
+	const Vector3& origin = p.at(i);
 	SphSpikyKernel kernel(_kernelRadius);
 
-	for (size_t j : neightbours)
+	if (isUsingPairCache())
 	{
-		Vector3 neighbourPosition = p.at(j);
+		const auto& distances = pairDistances();
+		for (size_t k = offsets[i]; k < offsets[i + 1]; ++k)
+		{
+			size_t j = indices[k];
+			sum += mass() * (values[j] - values[i]) / d[j] * kernel.secondDerivative(distances[k]);
+		}
+		return sum;
+	}
+
+	for (size_t k = offsets[i]; k < offsets[i + 1]; ++k)
+	{
+		size_t j = indices[k];
+		const Vector3& neighbourPosition = p.at(j);
 		double dist = origin.distanceTo(neighbourPosition);
 		sum += mass() * (values[j] - values[i]) / d[j] * kernel.secondDerivative(dist);
 	}
@@ -207,6 +287,11 @@ double SphSystemData::kernelRadius() const
 	return _kernelRadius;
 }
 
+unsigned int SphSystemData::parameterRevision() const
+{
+	return _parameterRevision;
+}
+
 void SphSystemData::computeMass()
 {
 	std::vector<Vector3> points;
@@ -29,6 +29,10 @@ public:
 
 	ParticleSystemData::doubleArray& pressures();
 
+	const ParticleSystemData::doubleArray& densities() const;
+
+	const ParticleSystemData::doubleArray& pressures() const;
+
 
 	//! Sets the target density of this particle system.
 	void setTargetDensity(double targetDensity);
@@ -69,17 +73,17 @@ public:
 
 	void updateDensities();
 
-	double sumOfKernelNearby(Vector3& pos);
+	double sumOfKernelNearby(const Vector3& pos);
 
 	Vector3 interpolate(
-		Vector3& origin,
-		std::vector<Vector3>& values);
+		const Vector3& origin,
+		const std::vector<Vector3>& values);
 
 	double interpolate(
-		Vector3& origin);
+		const Vector3& origin);
 
-	Vector3 gradientAt(size_t i, const std::vector<double>& values);
-	double laplacianAt(size_t i, const std::vector<double>& values);
+	Vector3 gradientAt(size_t i, const std::vector<double>& values) const;
+	double laplacianAt(size_t i, const std::vector<double>& values) const;
 
 	//! Builds neighbor searcher with kernel radius.
 	void buildNeighbourSearcher();
@@ -88,9 +92,20 @@ public:
 	void buildNeighbourLists();
 
 	double kernelRadius() const;
+
+	//!
+	//! \brief Returns a counter that changes with the SPH parameters.
+	//!
+	//! Incremented by setTargetDensity(), setTargetSpacing(),
+	//! setRelativeKernelRadius() and setKernelRadius(), so solvers can cache
+	//! values derived from them.
+	//!
+	unsigned int parameterRevision() const;
 private:
 	double _kernelRadius;
 
+	unsigned int _parameterRevision = 0;
+
 	//! Target density of this particle system in kg/m^3.
 	double _targetDensity = 1000.0;
 
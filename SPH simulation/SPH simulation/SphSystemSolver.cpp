@@ -1,4 +1,5 @@
 #include "SphSystemSolver.h"
+#include "Parallel.h"
 
 #include <memory>
 #include <cmath>
@@ -51,6 +52,87 @@ void SphSystemSolver::setTimeStepLimitScale(double newScale)
 	_timeStepLimitScale = std::max(newScale, 0.0);
 }
 
+bool SphSystemSolver::isUsingHalfNeighbourLists() const
+{
+	return _isUsingHalfNeighbourLists;
+}
+
+void SphSystemSolver::setIsUsingHalfNeighbourLists(bool isUsingHalfNeighbourLists)
+{
+	_isUsingHalfNeighbourLists = isUsingHalfNeighbourLists;
+}
+
+template <typename PairFunction>
+void SphSystemSolver::accumulateHalfNeighbourPairs(
+	std::vector<Vector3>& forces,
+	const PairFunction& pairFunc)
+{
+	auto particles = sphSystemData();
+	const size_t numberOfParticles = particles->numberOfParticles();
+	const auto& halfOffsets = particles->halfNeighbourOffsets();
+	const auto& halfEntries = particles->halfNeighbourEntries();
+	const auto& indices = particles->neighbourIndices();
+
+	const size_t numberOfChunks = parallelChunkCount(0, numberOfParticles);
+	if (numberOfChunks <= 1)
+	{
+		for (size_t i = 0; i < numberOfParticles; ++i)
+		{
+			for (size_t h = halfOffsets[i]; h < halfOffsets[i + 1]; ++h)
+			{
+				const size_t k = halfEntries[h];
+				const size_t j = indices[k];
+				Vector3 forceOnI, forceOnJ;
+				pairFunc(i, j, k, forceOnI, forceOnJ);
+				forces[i] += forceOnI;
+				forces[j] += forceOnJ;
+			}
+		}
+		return;
+	}
+
+	// Half lists only hold j > i, so a chunk owns every particle i it visits
+	// and every j below its end. Only pairs across a chunk boundary, which
+	// spatial sorting keeps to a small share, are kept aside and added in
+	// chunk order once all chunks are done.
+	if (_chunkForceSpills.size() < numberOfChunks)
+	{
+		_chunkForceSpills.resize(numberOfChunks);
+	}
+	parallelChunkFor(0, numberOfParticles, [&](size_t chunk, size_t chunkBegin, size_t chunkEnd)
+	{
+		auto& spills = _chunkForceSpills[chunk];
+		spills.clear();
+		for (size_t i = chunkBegin; i < chunkEnd; ++i)
+		{
+			for (size_t h = halfOffsets[i]; h < halfOffsets[i + 1]; ++h)
+			{
+				const size_t k = halfEntries[h];
+				const size_t j = indices[k];
+				Vector3 forceOnI, forceOnJ;
+				pairFunc(i, j, k, forceOnI, forceOnJ);
+				forces[i] += forceOnI;
+				if (j < chunkEnd)
+				{
+					forces[j] += forceOnJ;
+				}
+				else
+				{
+					spills.push_back(ForceSpill{ j, forceOnJ });
+				}
+			}
+		}
+	});
+
+	for (size_t chunk = 0; chunk < numberOfChunks; ++chunk)
+	{
+		for (const auto& spill : _chunkForceSpills[chunk])
+		{
+			forces[spill.particle] += spill.force;
+		}
+	}
+}
+
 unsigned int SphSystemSolver::numberOfSubTimeSteps(double timeIntervalInSeconds) const
 {
 	auto particles = sphSystemData();
@@ -90,6 +172,10 @@ void SphSystemSolver::onBeginAdvanceTimeStep(double timeStepInSeconds)
 {
 	sphSystemData()->buildNeighbourSearcher();
 	sphSystemData()->buildNeighbourLists();
+	if (_isUsingHalfNeighbourLists)
+	{
+		sphSystemData()->buildHalfNeighbourLists();
+	}
 	sphSystemData()->updateDensities();
 }
 
@@ -120,12 +206,70 @@ void SphSystemSolver::accumulatePressureForce(const std::vector<Vector3>& positi
 
 	const double massSquared = particles->mass()*particles->mass();
 	const SphSpikyKernel kernel(particles->kernelRadius());
+	const auto& offsets = particles->neighbourOffsets();
+	const auto& indices = particles->neighbourIndices();
 
-	for (size_t i = 0; i < numberOfParticles; i++)
+	// The pair cache holds the current positions, not predicted ones.
+	const bool isUsingPairCache =
+		particles->isUsingPairCache() && &positions == &particles->positions();
+	const auto& distances = particles->pairDistances();
+	const auto& directions = particles->pairDirections();
+
+	if (_isUsingHalfNeighbourLists)
 	{
-		const auto& neighbours = particles->neighborLists()[i];
-		for (size_t j : neighbours)
+		// The gradient flips sign with the direction, so particle j gets the
+		// opposite of particle i's contribution.
+		accumulateHalfNeighbourPairs(pressureForces,
+			[&](size_t i, size_t j, size_t k, Vector3& forceOnI, Vector3& forceOnJ)
 		{
+			Vector3 dir;
+			double dist;
+			if (isUsingPairCache)
+			{
+				dir = directions[k];
+				dist = distances[k];
+			}
+			else
+			{
+				dir = positions[j] - positions[i];
+				dist = dir.length();
+				if (dist > 0.0)
+				{
+					dir /= dist;
+				}
+			}
+
+			if (dist > 0.0)
+			{
+				Vector3 force = kernel.gradient(dist, dir) *
+					massSquared *
+					(pressures[i] / (densities[i]*densities[i]) +
+						pressures[j] / (densities[j]*densities[j]));
+				forceOnI = force * -1.0;
+				forceOnJ = force;
+			}
+		});
+		return;
+	}
+
+	parallelFor(0, numberOfParticles, [&](size_t i)
+	{
+		for (size_t k = offsets[i]; k < offsets[i + 1]; ++k)
+		{
+			size_t j = indices[k];
+			if (isUsingPairCache)
+			{
+				if (distances[k] > 0.0)
+				{
+					Vector3 dir = directions[k];
+					pressureForces[i] -= (kernel.gradient(distances[k], dir) *
+						massSquared *
+						(pressures[i] / (densities[i]*densities[i]) +
+							pressures[j] / (densities[j]*densities[j])));
+				}
+				continue;
+			}
+
 			Vector3 vec = positions[i];
 			double dist = vec.distanceTo(positions[j]);
 
@@ -140,7 +284,7 @@ void SphSystemSolver::accumulatePressureForce(const std::vector<Vector3>& positi
 							pressures[j] / (densities[j]*densities[j])));
 			}
 		}
-	}
+	});
 }
 
 void SphSystemSolver::computePressure()
@@ -167,50 +311,77 @@ void SphSystemSolver::accumulateViscosityForce()
 {
 	auto particles = sphSystemData();
 	size_t numberOfParticles = particles->numberOfParticles();
-	auto x = particles->positions();
-	auto v = particles->velocities();
-	auto d = particles->densities();
+	const auto& x = particles->positions();
+	const auto& v = particles->velocities();
+	const auto& d = particles->densities();
 
 	const double massSquared = particles->mass() * particles->mass();
 	const SphSpikyKernel kernel(particles->kernelRadius());
+	const auto& offsets = particles->neighbourOffsets();
+	const auto& indices = particles->neighbourIndices();
+	auto& forces = particles->forces();
+	const bool isUsingPairCache = particles->isUsingPairCache();
+	const auto& distances = particles->pairDistances();
 
-	for (size_t i = 0; i < numberOfParticles; ++i)
+	if (_isUsingHalfNeighbourLists)
 	{
-		const auto& neighbours = particles->neighborLists()[i];
-		for (size_t j : neighbours)
+		// Both directions share the distance and the kernel value, only the
+		// velocity difference and the density differ.
+		accumulateHalfNeighbourPairs(forces,
+			[&](size_t i, size_t j, size_t k, Vector3& forceOnI, Vector3& forceOnJ)
 		{
-			double dist = x[i].distanceTo(x[j]);			
+			double dist = isUsingPairCache ? distances[k] : x[i].distanceTo(x[j]);
+			double scale = _viscosityCoefficient * massSquared * kernel.secondDerivative(dist);
+			Vector3 dv = v[j] - v[i];
+
+			forceOnI = dv * (scale / d[j]);
+			forceOnJ = dv * (-scale / d[i]);
+		});
+		return;
+	}
+
+	parallelFor(0, numberOfParticles, [&](size_t i)
+	{
+		for (size_t k = offsets[i]; k < offsets[i + 1]; ++k)
+		{
+			size_t j = indices[k];
+			double dist = isUsingPairCache ? distances[k] : x[i].distanceTo(x[j]);
 
 			Vector3 add = (v[j]-v[i])/d[j];
 			add *= _viscosityCoefficient * massSquared * kernel.secondDerivative(dist);
 
-			sphSystemData()->forces()[i] += add;			
+			forces[i] += add;			
 		}
-	}
+	});
 }
 
 void SphSystemSolver::computePseudoViscosity(double timeStepInSeconds)
 {
 	auto particles = sphSystemData();
 	size_t numberOfParticles = particles->numberOfParticles();
-	auto x = particles->positions();
-	auto v = particles->velocities();
-	auto d = particles->densities();
+	const auto& x = particles->positions();
+	const auto& d = particles->densities();
+	auto& v = particles->velocities();
 
 	const double mass = particles->mass();
 	const SphSpikyKernel kernel(particles->kernelRadius());
+	const auto& offsets = particles->neighbourOffsets();
+	const auto& indices = particles->neighbourIndices();
+	const bool isUsingPairCache = particles->isUsingPairCache();
+	const auto& distances = particles->pairDistances();
 
-	std::vector<Vector3> smoothedVelocities(numberOfParticles);
+	auto& smoothedVelocities = _smoothedVelocities;
+	resizeScratchBuffer(smoothedVelocities, numberOfParticles);
 
 	for (size_t i = 0; i < numberOfParticles; i++)
 	{
 		double weightSum = 0.0;
 		Vector3 smoothedVelocity;
 
-		const auto& neighbours = particles->neighborLists().at(i);
-		for (size_t j : neighbours)
+		for (size_t k = offsets[i]; k < offsets[i + 1]; ++k)
 		{
-			double dist = x[i].distanceTo(x[j]);
+			size_t j = indices[k];
+			double dist = isUsingPairCache ? distances[k] : x[i].distanceTo(x[j]);
 			double wj = mass / d[j] * kernel(dist);
 
 			weightSum += wj;
@@ -235,7 +406,7 @@ void SphSystemSolver::computePseudoViscosity(double timeStepInSeconds)
 
 	for (size_t i = 0; i < numberOfParticles; i++)
 	{
-		particles->velocities()[i] += (smoothedVelocities[i] - v[i]) * factor;
+		v[i] += (smoothedVelocities[i] - v[i]) * factor;
 	}
 	
 }
@@ -36,6 +36,21 @@ public:
 
 	void setTimeStepLimitScale(double newScale);
 
+	//! Returns true if the pressure and viscosity forces are evaluated once
+	//! per pair.
+	bool isUsingHalfNeighbourLists() const;
+
+	//!
+	//! \brief Enables or disables the symmetric force evaluation.
+	//!
+	//! When enabled, the pressure and viscosity passes walk the half
+	//! neighbour lists and apply each pair's contribution to both particles.
+	//! Each parallel chunk writes its own particles directly and keeps its
+	//! contributions to later chunks aside, which are added in a fixed order,
+	//! so results do not depend on scheduling. Default is true.
+	//!
+	void setIsUsingHalfNeighbourLists(bool isUsingHalfNeighbourLists);
+
 	SphSystemDataPtr sphSystemData() const;
 
 protected:
@@ -86,6 +101,31 @@ private:
 
 	//! Scales the max allowed time-step.
 	double _timeStepLimitScale = 5.0;
+
+	bool _isUsingHalfNeighbourLists = true;
+
+	//! Force on a particle of a later chunk, found by a symmetric pass.
+	struct ForceSpill
+	{
+		size_t particle;
+		Vector3 force;
+	};
+
+	//! Per-chunk spills of the symmetric passes, kept between substeps.
+	std::vector<std::vector<ForceSpill>> _chunkForceSpills;
+
+	ParticleSystemData::vectorArray _smoothedVelocities;
+
+	//!
+	//! Calls \p pairFunc(i, j, k, forceOnI, forceOnJ) once for every pair of
+	//! the half neighbour lists, where k is the pair's entry in the full
+	//! lists and the function sets the contributions to both particles, and
+	//! adds the contributions to \p forces.
+	//!
+	template <typename PairFunction>
+	void accumulateHalfNeighbourPairs(
+		std::vector<Vector3>& forces,
+		const PairFunction& pairFunc);
 };
 
 typedef std::shared_ptr<SphSystemSolver> SphSystemSolverPtr;
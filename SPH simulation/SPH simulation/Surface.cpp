@@ -37,6 +37,40 @@ BoundingBox Surface::boundingBox()
 	return transform.toWorld(boundingBoxLocal());
 }
 
+SurfaceQueryResult Surface::closestQuery(const Vector3 & otherPoint)
+{
+	Vector3 pointInWorld = otherPoint;
+	SurfaceQueryResult result = closestQueryLocal(transform.toLocal(pointInWorld));
+	result.point = transform.toWorld(result.point);
+	result.normal = transform.toWorldDirection(result.normal);
+	result.normal *= (isNormalFlipped) ? -1.0 : 1.0;
+	result.isInside = isNormalFlipped == !result.isInside;
+	return result;
+}
+
+void Surface::closestQueries(const Vector3 * points, size_t numberOfPoints, SurfaceQueryResult * results)
+{
+	if (!transform.isIdentity())
+	{
+		for (size_t i = 0; i < numberOfPoints; ++i)
+		{
+			results[i] = closestQuery(points[i]);
+		}
+		return;
+	}
+
+	// Local and world frames coincide, only the normal flip is left.
+	for (size_t i = 0; i < numberOfPoints; ++i)
+	{
+		results[i] = closestQueryLocal(points[i]);
+		if (isNormalFlipped)
+		{
+			results[i].normal *= -1.0;
+			results[i].isInside = !results[i].isInside;
+		}
+	}
+}
+
 double Surface::closestDistanceLocal(Vector3 otherPoint)
 {
 	return otherPoint.distanceTo(closestPointLocal(otherPoint));
@@ -49,7 +83,30 @@ bool Surface::isInsideLocal(Vector3 otherPointLocal)
 	return (otherPointLocal-cpLocal).dot(normalLocal) < 0.0;
 }
 
+SurfaceQueryResult Surface::closestQueryLocal(const Vector3 & otherPoint)
+{
+	SurfaceQueryResult result;
+	result.point = closestPointLocal(otherPoint);
+	result.normal = closestNormalLocal(otherPoint);
+	result.distance = closestDistanceLocal(otherPoint);
+	result.isInside = isInsideLocal(otherPoint);
+	return result;
+}
+
 void Surface::updateQueryEngine()
 {
 	// Do nothing, this is only for tri-meshes
 }
+
+void Surface::depositToNodeDeferred(const Vector3 & pos, double amountToDeposit, std::vector<HeightDelta>& deltas) const
+{
+}
+
+double Surface::erodeNodeDeferred(const Vector3 & pos, double amountToErode, std::vector<HeightDelta>& deltas) const
+{
+	return 0.0;
+}
+
+void Surface::applyHeightDeltas(const std::vector<HeightDelta>& deltas)
+{
+}
@@ -17,6 +17,22 @@ struct SurfaceRayIntersection3
 	Vector3 normal;
 };
 
+//! Result of Surface::closestQuery().
+struct SurfaceQueryResult
+{
+	Vector3 point;
+	Vector3 normal;
+	double distance = std::numeric_limits<double>::max();
+	bool isInside = false;
+};
+
+//! Height change of one terrain node, recorded by the deferred erosion calls.
+struct HeightDelta
+{
+	size_t node;
+	double delta;
+};
+
 class Surface
 {
 public:
@@ -55,6 +71,28 @@ public:
 	//! Returns the bounding box of this surface object.
 	BoundingBox boundingBox();
 
+	//!
+	//! \brief Returns the closest point, normal, distance and inside flag for
+	//! \p otherPoint in one query.
+	//!
+	//! Same results as closestPoint(), closestNormal(), closestDistance() and
+	//! isInside(), but the point is transformed once and surfaces that
+	//! override closestQueryLocal() share their lookup between the four.
+	//!
+	SurfaceQueryResult closestQuery(const Vector3& otherPoint);
+
+	//!
+	//! \brief Runs closestQuery() for \p numberOfPoints points.
+	//!
+	//! Checks the transform once for the whole batch. Surfaces can override
+	//! this with a loop that avoids the per-point virtual calls. Safe to call
+	//! from several threads on disjoint arrays.
+	//!
+	virtual void closestQueries(
+		const Vector3* points,
+		size_t numberOfPoints,
+		SurfaceQueryResult* results);
+
 	//! Updates internal spatial query engine.
 	virtual void updateQueryEngine();
 
@@ -62,6 +100,28 @@ public:
 
 	virtual double erodeNode(Vector3 pos, double amountToErode) = 0;
 
+	//!
+	//! \brief Same as depositToNode(), but appends the height changes to
+	//! \p deltas instead of applying them.
+	//!
+	//! Only reads the surface, so several threads can call it at once. The
+	//! default does nothing, like the depositToNode() of non-terrain surfaces.
+	//!
+	virtual void depositToNodeDeferred(
+		const Vector3& pos,
+		double amountToDeposit,
+		std::vector<HeightDelta>& deltas) const;
+
+	//! Same as erodeNode(), but appends the height changes to \p deltas.
+	//! Returns the eroded sediment.
+	virtual double erodeNodeDeferred(
+		const Vector3& pos,
+		double amountToErode,
+		std::vector<HeightDelta>& deltas) const;
+
+	//! Applies height changes recorded by the deferred calls, in order.
+	virtual void applyHeightDeltas(const std::vector<HeightDelta>& deltas);
+
 	virtual std::vector<Vector3> getVertices() = 0;
 
 protected:
@@ -83,6 +143,10 @@ protected:
 
 	//! Returns the bounding box of this surface object in local frame.
 	virtual BoundingBox boundingBoxLocal() const = 0;
+
+	//! Returns closestQuery() in local frame, without the normal flip. The
+	//! default calls the four separate local queries.
+	virtual SurfaceQueryResult closestQueryLocal(const Vector3& otherPoint);
 };
 
 typedef std::shared_ptr<Surface> SurfacePtr;
@@ -30,6 +30,13 @@ void Transform::setTranslation(const Vector3 & translation)
 	_translation = translation;
 }
 
+bool Transform::isIdentity() const
+{
+	return _translation.x == 0.0 && _translation.y == 0.0 && _translation.z == 0.0 &&
+		_orientation.w == 1.0f && _orientation.x == 0.0f &&
+		_orientation.y == 0.0f && _orientation.z == 0.0f;
+}
+
 Vector3 Transform::toLocal(Vector3& pointInWorld)
 {
 	return _inverseOrientationMat3.vectorMultiply((pointInWorld - _translation));
@@ -25,6 +25,9 @@ public:
 	//! Sets the traslation.
 	void setTranslation(const Vector3& translation);
 
+	//! Returns true if the transform has no translation and no rotation.
+	bool isIdentity() const;
+
 	//! Transforms a point in world coordinate to the local frame.
 	Vector3 toLocal(Vector3& pointInWorld);
 	
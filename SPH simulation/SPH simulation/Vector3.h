@@ -90,11 +90,11 @@ public:
 	{
 		return std::sqrt(x * x + y * y + z * z);
 	}
-	double lengthSquared()
+	double lengthSquared() const
 	{
 		return x * x + y * y + z * z;
 	}
-	double distanceTo(Vector3 vec)
+	double distanceTo(Vector3 vec) const
 	{
 		return this->operator-(vec).length();
 	}
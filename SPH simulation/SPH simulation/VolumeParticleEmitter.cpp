@@ -237,6 +237,7 @@ void VolumeParticleEmitter::emit(const ParticleSystemDataPtr & particles, std::v
 		// Use serial hash grid searcher for continuous update.
 		PointHashGridSearcher neighborSearcher(Vector3(64,64,64),
 			2.0 * _spacing);
+		neighborSearcher.setBuildMode(PointHashGridSearcher::BuildMode::Buckets);
 		if (!_allowOverlapping) 
 		{
 			neighborSearcher.build(particles->positions());
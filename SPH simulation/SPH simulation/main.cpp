@@ -9,6 +9,7 @@
 #include <chrono>
 
 #include "Animation.h"
+#include "AsyncFrameWriter.h"
 #include "BccLatticePointGenerator.h"
 #include "BoundingBox.h"
 #include "Collider.h"
@@ -34,10 +35,28 @@
 #include "VolumeParticleEmitter.h"
 #include "RigidBodyCollider.h"
 #include "Heightfield.h"
+#include "Benchmark.h"
 
 double x_size = 100;
 double z_size = 100;
 bool saveAllFrames = true;
+//! Runs the benchmarks instead of the simulation, and the allocation
+//! check when built with SPH_ALLOCATION_CHECKS.
+bool runBenchmarks = false;
+//! Snapshot buffers of the background frame writer, 2 is double buffering.
+size_t frameExportBuffers = 2;
+//! Writes heights as dirty tile deltas against periodic keyframes.
+bool exportHeightDeltas = true;
+//! Frames between full heightfield keyframes.
+size_t heightKeyframeInterval = 30;
+//! Writes positions quantised to 16 bits per axis as deltas against keyframes.
+bool exportQuantisedPositions = true;
+//! Largest position error of quantised positions, 0 uses the full 16 bits.
+double positionErrorBound = 0.0;
+//! Frames between full position keyframes.
+size_t positionKeyframeInterval = 30;
+//! Writes all frames to one archive instead of one file per frame.
+bool exportArchive = true;
 
 double maxHeight;
 void generateInitialVertices(std::vector<Vector3>* vertArray, int width, int depth)
@@ -147,52 +166,80 @@ void perlinNoise(int width, int height, int octaves, float Bias, std::vector<Vec
 	}
 }
 
-void runSimulation(const PciSphSystemSolverPtr& solver, int numberOfFrames, double fps) 
+void runSimulation(
+	const PciSphSystemSolverPtr& solver,
+	const HeightfieldPtr& heightfield,
+	const BoundingBox& exportBounds,
+	int numberOfFrames,
+	double fps) 
 {	
 	auto particles = solver->sphSystemData();
 
+	// Unity centres the terrain on the origin.
+	AsyncFrameWriter frameWriter(frameExportBuffers);
+	frameWriter.setOffset(Vector3(-x_size / 2, -maxHeight / 2, -z_size / 2));
+	frameWriter.frameWriter().setIsUsingHeightDeltas(exportHeightDeltas);
+	frameWriter.frameWriter().heightEncoder().setKeyframeInterval(heightKeyframeInterval);
+	frameWriter.frameWriter().setIsUsingQuantisedPositions(exportQuantisedPositions);
+	frameWriter.frameWriter().positionEncoder().setBounds(exportBounds);
+	frameWriter.frameWriter().positionEncoder().setErrorBound(positionErrorBound);
+	frameWriter.frameWriter().positionEncoder().setKeyframeInterval(positionKeyframeInterval);
+	std::vector<Vector3> positions;
+
+	const std::string archiveFilename = "..//..//Assets/Positions/Frames.sfa";
+	const bool isUsingArchive = exportArchive && frameWriter.openArchive(archiveFilename);
+	if (exportArchive && !isUsingArchive)
+	{
+		printf("Could not create %s, writing one file per frame\n", archiveFilename.c_str());
+	}
+	if (!isUsingArchive)
+	{
+		// The viewer prefers an archive, so an old one would hide the new frames.
+		std::remove(archiveFilename.c_str());
+	}
+
 	for (Frame frame(0, 1.0 / fps); frame.index < numberOfFrames; ++frame)
 	{
 		solver->Update(frame);
 
-		std::vector<Vector3> positions = particles->positions();
+		// Write particles in ID order, spatial sorting moves them between slots.
+		const auto& ids = particles->particleIds();
+		positions.resize(particles->numberOfParticles());
+		for (size_t i = 0; i < positions.size(); i++)
+		{
+			positions[ids[i]] = particles->positions()[i];
+		}
 
 		if (saveAllFrames || frame.index == numberOfFrames-1)
 		{
-			std::string filename = "..//..//Assets/Positions/DamBreak" + std::to_string(frame.index) + ".txt";
-			std::ofstream file;
-			file.open(filename);
-			if (file)
-			{
-				printf("Writing %s...\n", filename.c_str());
-
-				for (size_t i = 0; i < positions.size(); i++)
-				{
-					std::string buffer = std::to_string(positions[i].x - x_size / 2) + "," + std::to_string(positions[i].y - maxHeight / 2) + "," + std::to_string(positions[i].z - z_size / 2) + ",";
-					file << buffer;
-				}
-				file.close();
-			}
-			std::vector<Vector3> vertices = solver->collider()->surface()->getVertices();
-
-			filename = "..//..//Assets/Positions/Mesh" + std::to_string(frame.index) + ".txt";
-			file.open(filename);
-			if (file)
-			{
-				printf("Writing %s...\n", filename.c_str());
-				for (size_t i = 0; i < vertices.size(); i++)
-				{
-					std::string buffer = std::to_string(vertices[i].x - x_size / 2) + "," + std::to_string(vertices[i].y - maxHeight / 2) + "," + std::to_string(vertices[i].z - z_size / 2) + ",";
-					file << buffer;
-				}
-				file.close();
-			}
+			std::string filename = isUsingArchive ? archiveFilename
+				: "..//..//Assets/Positions/Frame" + std::to_string(frame.index) + ".bin";
+			printf("Writing frame %d to %s...\n", frame.index, filename.c_str());
+			frameWriter.submitFrame(
+				filename,
+				static_cast<uint32_t>(frame.index),
+				positions,
+				*heightfield);
 		}
 		else
 		{
 			std::cout << frame.index << '\n';
 		}
-	}	
+	}
+
+	if (isUsingArchive && !frameWriter.closeArchive())
+	{
+		printf("Could not write %s\n", archiveFilename.c_str());
+	}
+	frameWriter.flush();
+	printf("Frame export: %zu written, %zu failed, peak queue depth %zu of %zu, "
+		"stalled %zu times for %.3f s\n",
+		frameWriter.numberOfWrittenFrames(),
+		frameWriter.numberOfFailedFrames(),
+		frameWriter.peakQueueDepth(),
+		frameWriter.numberOfBuffers(),
+		frameWriter.numberOfStalls(),
+		frameWriter.stallTimeInSeconds());
 }
 
 void damBreakSim(double targetSpacing,
@@ -210,6 +257,8 @@ void damBreakSim(double targetSpacing,
 
 	solver->setPseudoViscosityCoefficient(0.0);
 	solver->setTimeStepLimitScale(10.0);
+	solver->sphSystemData()->setSpatialSortInterval(10);
+	solver->sphSystemData()->setIsUsingPairCache(true);
 
 	// Build emitter
 	//BoundingBox sourceBound(domain);
@@ -296,10 +345,22 @@ void damBreakSim(double targetSpacing,
 	}
 
 	// Run simulation
-	runSimulation(solver, numberOfFrames, fps);
+	runSimulation(solver, heightfield, maxRegion->boundingBox(), numberOfFrames, fps);
 }
 
 int main()
 {
+	if (runBenchmarks)
+	{
+#ifdef SPH_ALLOCATION_CHECKS
+		if (!checkAllocations(20000, 0.25))
+		{
+			return 1;
+		}
+#endif
+		runDensityPassBenchmark(20000, 0.25, 20);
+		runPairForceBenchmark(20000, 0.25, 5, 3);
+		return 0;
+	}
 	damBreakSim(0.25, 1000, 60);
 }